@@ -0,0 +1,281 @@
+
+#include <linux/kernel.h>
+#include <linux/io.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmapool.h>
+#include <linux/timekeeping.h>
+
+#include "garage-driver.h"
+#include "garage-bcm.h"
+#include "garage-dma.h"
+#include "garage-pwm.h"
+#include "garage-clk.h"
+
+// garage_ops backend for the real hardware: ioremap()ed peripherals and
+// a DMA channel borrowed from dmaengine
+
+static void *bcm_block(struct garage_dev *g, int block)
+{
+    switch(block) {
+        case GARAGE_GPIO: return g->gpio_reg;
+        case GARAGE_PWM: return g->pwm_reg;
+        case GARAGE_CLK: return g->clk_reg;
+        case GARAGE_DMA: return g->dma_chan_base;
+    }
+
+    return NULL;
+}
+
+static u32 bcm_read(struct garage_dev *g, int block, u32 offset)
+{
+    void *base = bcm_block(g, block);
+
+    if(base == NULL)
+        return 0;
+
+    return readl(base + offset);
+}
+
+// writes to blocks not mapped (yet) are dropped, so garage_stop()
+// can be used on a half initialised device
+static void bcm_write(struct garage_dev *g, int block, u32 offset, u32 val)
+{
+    void *base = bcm_block(g, block);
+
+    if(base)
+        writel(val, base + offset);
+}
+
+static void *bcm_dma_alloc(struct garage_dev *g, size_t size, dma_addr_t *handle)
+{
+    return dma_alloc_writecombine(g->dev, size, handle, GFP_KERNEL);
+}
+
+static void bcm_dma_free(struct garage_dev *g, size_t size, void *cpu, dma_addr_t handle)
+{
+    dma_free_writecombine(g->dev, size, cpu, handle);
+}
+
+// programs are only compiled in process context (see queue_run()), so
+// this may sleep
+static struct bcm2708_dma_cb *bcm_cb_alloc(struct garage_dev *g, dma_addr_t *handle)
+{
+    return dma_pool_alloc(g->cb_pool, GFP_KERNEL, handle);
+}
+
+static void bcm_cb_free(struct garage_dev *g, struct bcm2708_dma_cb *cpu, dma_addr_t handle)
+{
+    dma_pool_free(g->cb_pool, cpu, handle);
+}
+
+// every interrupt raised by our CBs ends up here, and goes to the callback
+// of the program on air (only the first one, unless it is cyclic)
+static void bcm_dma_irq(void *data)
+{
+    struct garage_dev *g = data;
+    garage_callback_t callback;
+    unsigned long flags;
+
+    spin_lock_irqsave(&g->dma_lock, flags);
+    callback = g->dma_callback;
+    if(!g->dma_cyclic)
+        g->dma_callback = NULL;
+    spin_unlock_irqrestore(&g->dma_lock, flags);
+
+    if(callback)
+        callback(g);
+}
+
+// bcm2835 dmaengine driver does not support interlived transactions.
+// Here we use a hack to get an exclusive access to the channel registers,
+// while letting dmaengine handle the IRQ for us.
+//
+// A cyclic dummy tx never completes, so dmaengine keeps invoking the callback
+// on every interrupt raised by our CBs. It is submitted once, at probe.
+static int start_dummy_tx(struct garage_dev *g, dma_async_tx_callback callback)
+{
+    struct dma_async_tx_descriptor *desc;
+    dma_cookie_t cookie;
+    struct dma_slave_config slave_config = {};
+    dma_addr_t src_ad;
+    int i, err;
+
+    if((err = dmaengine_terminate_all(g->dma_chan)) < 0) {
+        dev_err(g->dev, "dmaengine_terminate_all failed\n");
+        return err;
+    }
+
+    slave_config.dst_addr_width = DMA_SLAVE_BUSWIDTH_4_BYTES;
+    slave_config.dst_addr = 0x7e200028;
+    slave_config.src_maxburst = 1;
+    slave_config.dst_maxburst = 1;
+    slave_config.slave_id = 5;
+    slave_config.direction = DMA_MEM_TO_DEV;
+    slave_config.device_fc = false;
+
+    if (dmaengine_slave_config(g->dma_chan, &slave_config)) {
+        dev_err(g->dev, "failed to configure dma channel\n");
+        return -EINVAL;
+    }
+
+    // two dummy periods, will be ignored
+    desc = dmaengine_prep_dma_cyclic(
+            g->dma_chan,
+            g->buf_handle, 8, 4,
+            DMA_MEM_TO_DEV,
+            DMA_PREP_INTERRUPT);
+
+    if (!desc) {
+        dev_err(g->dev, "error: dmaengine_prep_dma_cyclic failed\n");
+        return -EINVAL;
+    }
+
+    desc->callback = callback;
+    desc->callback_param = g;
+
+    // submit tx, while DREQ is inactive, so we can identify 
+    // hardware channel number and hack our own CBs
+    cookie = dmaengine_submit(desc);
+
+    err = dma_submit_error(cookie);
+    if(err) {
+        dev_err(g->dev, "error: dmaengine_submit failed\n");
+        return err;
+    }
+
+    g->dma_chan->device->device_issue_pending(g->dma_chan);
+
+    // guess hw channel number by looking for transfer source addess in DMA registers
+    for(i=0;i<15;i++) {
+        g->dma_chan_base = g->dma_reg + i*0x100;
+        src_ad = readl(g->dma_chan_base + BCM2708_DMA_SOURCE_AD);
+        // DMA read is not controled by DREQ, so src address must be already incremeted
+        if(src_ad == g->buf_handle + 4) {
+            printk(KERN_INFO "Detected hw channel %d.\n", i);
+            break;
+        }
+    }
+
+    if(i == 15) {
+        g->dma_chan_base = NULL;
+        dev_err(g->dev, "error: failed to identify allocated channel\n");
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+// the channel is already ours, a new program only needs its callback
+static int bcm_chan_claim(struct garage_dev *g, garage_callback_t callback, int cyclic)
+{
+    unsigned long flags;
+
+    if(g->dma_chan_base == NULL)
+        return -ENODEV;
+
+    spin_lock_irqsave(&g->dma_lock, flags);
+    g->dma_callback = callback;
+    g->dma_cyclic = cyclic;
+    spin_unlock_irqrestore(&g->dma_lock, flags);
+
+    return 0;
+}
+
+static u64 bcm_now(struct garage_dev *g)
+{
+    return ktime_get_ns();
+}
+
+const struct garage_ops bcm_ops = {
+    .read = bcm_read,
+    .write = bcm_write,
+    .dma_alloc = bcm_dma_alloc,
+    .dma_free = bcm_dma_free,
+    .cb_alloc = bcm_cb_alloc,
+    .cb_free = bcm_cb_free,
+    .chan_claim = bcm_chan_claim,
+    .now = bcm_now,
+};
+
+int bcm_allocate(struct garage_dev *g)
+{
+    dma_cap_mask_t mask;
+
+    g->ops = &bcm_ops;
+    spin_lock_init(&g->dma_lock);
+
+    g->gpio_reg = ioremap(GPIO_BASE, SZ_16K);
+    g->pwm_reg = ioremap(PWM_BASE, SZ_16K);
+    g->clk_reg = ioremap(CLK_BASE, SZ_16K);
+    g->dma_reg = ioremap(DMA_BASE, SZ_16K);
+
+    if(g->gpio_reg == NULL || g->pwm_reg == NULL || g->clk_reg == NULL || g->dma_reg == NULL) {
+        dev_err(g->dev, "error: failed to ioremap registers\n");
+        return -ENOMEM;
+    }
+
+    // CBs must be 32 byte aligned
+    g->cb_pool = dma_pool_create("garage-cb", g->dev, CB_CHUNK_SIZE, 32, 0);
+    if(g->cb_pool == NULL) {
+        dev_err(g->dev, "error: failed to create CB pool\n");
+        return -ENOMEM;
+    }
+
+    dma_cap_zero(mask);
+    dma_cap_set(DMA_SLAVE, mask);
+    g->dma_chan = dma_request_channel(mask, NULL, NULL);
+    if(g->dma_chan == NULL) {
+        dev_err(g->dev, "error: DMA request channel failed\n");
+        return -EIO;
+    }
+
+    printk(KERN_INFO "Allocated DMA channel %d\n", g->dma_chan->chan_id);
+
+    return 0;
+}
+
+// claim and identify the hardware channel for good, needs the constant
+// words (dma_allocate()) for the dummy tx
+int bcm_start(struct garage_dev *g)
+{
+    int err;
+
+    pwm_stop(g); // keep DREQ low, the dummy tx must not move
+
+    if((err = start_dummy_tx(g, bcm_dma_irq)) < 0)
+        return err;
+
+    // the dummy CBs are never run, our programs replace them
+    dma_reset(g);
+
+    return 0;
+}
+
+void bcm_release(struct garage_dev *g)
+{
+    if(g->dma_chan_base)
+        dma_reset(g);
+
+    if(g->dma_chan) {
+        dmaengine_terminate_all(g->dma_chan);
+        dma_release_channel(g->dma_chan);
+    }
+
+    if(g->cb_pool)
+        dma_pool_destroy(g->cb_pool);
+
+    if(g->gpio_reg)
+        iounmap(g->gpio_reg);
+    if(g->pwm_reg)
+        iounmap(g->pwm_reg);
+    if(g->clk_reg)
+        iounmap(g->clk_reg);
+    if(g->dma_reg)
+        iounmap(g->dma_reg);
+
+    g->dma_chan = NULL;
+    g->cb_pool = NULL;
+    g->dma_chan_base = NULL;
+    g->gpio_reg = g->pwm_reg = g->clk_reg = g->dma_reg = NULL;
+}
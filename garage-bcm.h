@@ -0,0 +1,13 @@
+
+#ifndef __GARAGE_BCM_H__
+#define __GARAGE_BCM_H__
+
+struct garage_dev;
+
+extern const struct garage_ops bcm_ops;
+
+int bcm_allocate(struct garage_dev *g);
+int bcm_start(struct garage_dev *g);
+void bcm_release(struct garage_dev *g);
+
+#endif
@@ -1,45 +1,150 @@
 
-#include <linux/kernel.h>
-#include <linux/io.h>
-#include <linux/clk.h>
-#include <linux/timekeeping.h>
-
 #include "garage-driver.h"
 #include "garage-clk.h"
 
-int pwm_clock_init(struct garage_dev *g, int freq)
+// compute PWMCLK_CNTL and PWMCLK_DIV words for 'freq' (2x carrier frequency)
+int pwm_clock_calc(int freq, u32 *ctl, u32 *div)
 {
     int divi, divf;
     long long tmp;
     int mash;
-    u32 ctl;
 
-    if(g->freq < 1000000L || g->freq > 500000000L) {
+    if(freq/2 < 1000000L || freq/2 > 500000000L) {
         return -EINVAL;
     }
 
-    if(g->freq < 100000000L)
+    if(freq/2 < 100000000L)
         mash = 3;
-    else if(g->freq <= 150000000L)
+    else if(freq/2 <= 150000000L)
         mash = 2;
     else
         mash = 1;
 
-    ctl = CLK_PASSWD | CLKCNTL_MASH(mash) | PLL_1GHZ;
     divi = GHZ/freq;
     tmp = 0x1000LL*(GHZ%freq);
     do_div(tmp, freq);
     divf = (int) tmp;
 
-    writel(ctl, g->clk_reg + PWMCLK_CNTL); // disable clock
-    writel(CLK_PASSWD | CLKDIV_DIVI(divi) | CLKDIV_DIVF(divf), g->clk_reg + PWMCLK_DIV); // set div ratio
-    writel(ctl | CLKCNTL_ENAB, g->clk_reg + PWMCLK_CNTL); // enable clock
+    *ctl = CLK_PASSWD | CLKCNTL_MASH(mash) | PLL_1GHZ;
+    *div = CLK_PASSWD | CLKDIV_DIVI(divi) | CLKDIV_DIVF(divf);
 
     return 0;
 }
 
+// PWMCLK_DIV words for the FSK tones. PWMCLK_CNTL is not rewritten while
+// sending, so all tones must use the same MASH as the carrier, and tones
+// closer than a DIVF step apart would be the same divisor.
+int pwm_tone_calc(const struct garage_params *params, u32 *divs)
+{
+    u32 ctl, div, tone_ctl;
+    int i, j, err;
+
+    if(params->ntones != 2 && params->ntones != 4 && params->ntones != 8)
+        return -EINVAL;
+
+    if((err = pwm_clock_calc(params->freq*2, &ctl, &div)) < 0)
+        return err;
+
+    for(i=0;i<params->ntones;i++) {
+        if((err = pwm_clock_calc(params->tones[i]*2, &tone_ctl, &divs[i])) < 0)
+            return err;
+
+        if(tone_ctl != ctl)
+            return -ERANGE;
+
+        for(j=0;j<i;j++) {
+            if(divs[j] == divs[i])
+                return -ERANGE;
+        }
+    }
+
+    return params->ntones;
+}
+
+// PWMCLK_DIV words of a carrier sweep, from sweep_from to sweep_to in
+// sweep_step increments. Steps finer than the divider are dropped, and
+// like tones, all of them must use the carrier's MASH. The frame is built
+// once for the carrier, so steps off by more than SWEEP_MAX_DRIFT are
+// out of range.
+int pwm_sweep_calc(const struct garage_params *params, u32 *divs)
+{
+    u32 ctl, div, step_ctl;
+    int n = 0, err;
+    long long f, drift;
+
+    if(params->sweep_step <= 0 || params->sweep_from > params->sweep_to)
+        return -EINVAL;
+
+    if((err = pwm_clock_calc(params->freq*2, &ctl, &div)) < 0)
+        return err;
+
+    for(f=params->sweep_from;f<=params->sweep_to;f+=params->sweep_step) {
+        if((err = pwm_clock_calc((int)(f*2), &step_ctl, &div)) < 0)
+            return err;
+
+        if(step_ctl != ctl)
+            return -ERANGE;
+
+        drift = f > params->freq ? f - params->freq : params->freq - f;
+        if(drift*1000000 > (long long)SWEEP_MAX_DRIFT*params->freq)
+            return -ERANGE;
+
+        if(n > 0 && divs[n-1] == div)
+            continue;
+
+        if(n == SWEEP_MAX)
+            return -E2BIG;
+
+        divs[n++] = div;
+    }
+
+    return n;
+}
+
+void pwm_clock_set(struct garage_dev *g, u32 ctl, u32 div)
+{
+    garage_write(g, GARAGE_CLK, PWMCLK_CNTL, ctl); // disable clock
+    garage_write(g, GARAGE_CLK, PWMCLK_DIV, div); // set div ratio
+    garage_write(g, GARAGE_CLK, PWMCLK_CNTL, ctl | CLKCNTL_ENAB); // enable clock
+}
+
 
 void pwm_clock_stop(struct garage_dev *g)
 {
-    writel(CLK_PASSWD | CLKCNTL_MASH(0) | PLL_500MHZ, g->clk_reg + PWMCLK_CNTL);
+    garage_write(g, GARAGE_CLK, PWMCLK_CNTL, CLK_PASSWD | CLKCNTL_MASH(0) | PLL_500MHZ);
+}
+
+// GPCLKx_CNTL and GPCLKx_DIV words for a 'freq' carrier. The clock drives
+// its pin directly, so unlike the PWM clock it runs at the carrier
+// frequency itself. MASH 3 needs DIVI of 5 at least, GPCLK_MAX_FREQ keeps
+// it at 8 or more, so the finest noise shaping is always usable.
+int gpclk_calc(int freq, u32 *ctl, u32 *div)
+{
+    int divi, divf;
+    long long tmp;
+
+    if(freq < GPCLK_MIN_FREQ || freq > GPCLK_MAX_FREQ)
+        return -EINVAL;
+
+    divi = GHZ/freq;
+    tmp = 0x1000LL*(GHZ%freq);
+    do_div(tmp, freq);
+    divf = (int) tmp;
+
+    *ctl = CLK_PASSWD | CLKCNTL_MASH(3) | PLL_1GHZ;
+    *div = CLK_PASSWD | CLKDIV_DIVI(divi) | CLKDIV_DIVF(divf);
+
+    return 0;
+}
+
+void gpclk_set(struct garage_dev *g, u32 ctl, u32 div)
+{
+    garage_write(g, GARAGE_CLK, GPCLK0_CNTL, ctl);
+    garage_write(g, GARAGE_CLK, GPCLK0_DIV, div);
+    garage_write(g, GARAGE_CLK, GPCLK0_CNTL, ctl | CLKCNTL_ENAB);
+}
+
+void gpclk_stop(struct garage_dev *g)
+{
+    garage_write(g, GARAGE_CLK, GPCLK0_CNTL, CLK_PASSWD | CLKCNTL_MASH(0) | PLL_500MHZ);
 }
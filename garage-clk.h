@@ -5,6 +5,13 @@
 #define CLK_BASE        (BCM2708_PERI_BASE + 0x101000)
 #define PWMCLK_CNTL     0xa0
 #define PWMCLK_DIV      0xa4
+#define GPCLK0_CNTL     0x70
+#define GPCLK0_DIV      0x74
+
+// GPCLK output range: the divider is 12 bits, and the pads don't go much
+// above 125 MHz
+#define GPCLK_MIN_FREQ  250000
+#define GPCLK_MAX_FREQ  125000000
 
 #define GHZ             1000000000
 
@@ -21,8 +28,15 @@
 #define CLKDIV_DIVF(x)  (x << 0)
 
 struct garage_dev;
+struct garage_params;
 
-int pwm_clock_init(struct garage_dev *g, int freq);
+int pwm_clock_calc(int freq, u32 *ctl, u32 *div);
+int pwm_tone_calc(const struct garage_params *params, u32 *divs);
+int pwm_sweep_calc(const struct garage_params *params, u32 *divs);
+void pwm_clock_set(struct garage_dev *g, u32 ctl, u32 div);
 void pwm_clock_stop(struct garage_dev *g);
+int gpclk_calc(int freq, u32 *ctl, u32 *div);
+void gpclk_set(struct garage_dev *g, u32 ctl, u32 div);
+void gpclk_stop(struct garage_dev *g);
 
 #endif
@@ -0,0 +1,218 @@
+
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+#include <linux/uaccess.h>
+
+#include "garage-driver.h"
+#include "garage-dma.h"
+#include "garage-seq.h"
+#include "garage-queue.h"
+#include "garage-verify.h"
+#include "garage-debug.h"
+
+// debugfs files, in /sys/kernel/debug/garage-door/:
+//
+// program  the timeline decoded from the CBs of the last transmission, EBUSY
+//          while one is in progress
+// verify   write a sequence to compile it with the current parameters
+//          (without sending it) and check the CBs against it, read the report
+// stats    latency of the transmit path stages, write anything to reset
+// dreq_probe  1 to spin up to DREQ_POLL_NS after every start for the
+//          first DREQ stage, 0 (default) not to
+
+static ssize_t program_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos)
+{
+    struct garage_dev *g = file->private_data;
+    struct garage_timeline t;
+    struct garage_span *spans;
+    char *report;
+    ssize_t ret;
+    int n = 0, cbs, err;
+
+    if(g->tx.srate == 0)
+        return 0;
+
+    // hold the transmitter, trim_work frees CB chunks and a job rebuilds them
+    if(test_and_set_bit(GARAGE_BUSY, &g->flags))
+        return -EBUSY;
+
+    report = kmalloc(DEBUG_REPORT_SIZE, GFP_KERNEL);
+    spans = kmalloc_array(g->prog.max/2 + 1, sizeof(*spans), GFP_KERNEL);
+    if(report != NULL && spans != NULL) {
+        timeline_init(&t, spans, g->prog.max/2 + 1);
+        err = verify_decode(g, &g->prog, &g->tx, &t);
+        cbs = g->prog.sample;
+    }
+
+    clear_bit(GARAGE_BUSY, &g->flags);
+
+    // run jobs queued while we held the transmitter
+    queue_run(g);
+
+    if(report == NULL || spans == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    n += scnprintf(report + n, DEBUG_REPORT_SIZE - n, "program: %d CBs, %d spans, %llu samples, %d irq\n",
+            cbs, t.n, (unsigned long long)t.samples, t.irqs);
+    if(err < 0)
+        n += scnprintf(report + n, DEBUG_REPORT_SIZE - n, "error: %d\n", err);
+    n += timeline_print(&t, timeline_period_ps(&g->tx, g->tx_clk_div), report + n, DEBUG_REPORT_SIZE - n);
+
+    ret = simple_read_from_buffer(ubuf, count, ppos, report, n);
+
+out:
+    kfree(spans);
+    kfree(report);
+    return ret;
+}
+
+static ssize_t verify_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos)
+{
+    struct garage_dev *g = file->private_data;
+    ssize_t ret;
+
+    mutex_lock(&g->debug_lock);
+    ret = simple_read_from_buffer(ubuf, count, ppos, g->debug_report, g->debug_len);
+    mutex_unlock(&g->debug_lock);
+
+    return ret;
+}
+
+static ssize_t verify_write(struct file *file, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+    struct garage_dev *g = file->private_data;
+    struct garage_params params;
+    struct garage_prog *p = NULL;
+    u8 *buf;
+    int err;
+
+    garage_params_get(g, &params);
+
+    if(params.freq == 0 || params.srate == 0)
+        return -EINVAL;
+
+    if(count == 0 || count > QUEUE_MAX_SEQ)
+        return -EINVAL;
+
+    buf = memdup_user(ubuf, count);
+    if(IS_ERR(buf))
+        return PTR_ERR(buf);
+
+    // the chunk table is too big for the stack
+    p = kzalloc(sizeof(*p), GFP_KERNEL);
+    if(p == NULL) {
+        err = -ENOMEM;
+        goto out;
+    }
+
+    if((err = prog_alloc(g, p)) < 0)
+        goto out;
+
+    mutex_lock(&g->debug_lock);
+
+    err = compile_check(g, p, &params, buf, count);
+    if(err == 0)
+        err = verify_sequence(g, p, &params, buf, count, g->debug_report, DEBUG_REPORT_SIZE);
+
+    if(err < 0)
+        g->debug_len = scnprintf(g->debug_report, DEBUG_REPORT_SIZE, "error: %d\n", err);
+    else
+        g->debug_len = strlen(g->debug_report);
+
+    mutex_unlock(&g->debug_lock);
+
+    prog_free(g, p);
+
+out:
+    kfree(p);
+    kfree(buf);
+    return err < 0 ? err : count;
+}
+
+static ssize_t stats_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos)
+{
+    struct garage_dev *g = file->private_data;
+    ssize_t ret;
+    char *buf;
+    int n;
+
+    buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+    if(buf == NULL)
+        return -ENOMEM;
+
+    n = stats_print(g, buf, PAGE_SIZE);
+    ret = simple_read_from_buffer(ubuf, count, ppos, buf, n);
+
+    kfree(buf);
+    return ret;
+}
+
+static ssize_t stats_write(struct file *file, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+    struct garage_dev *g = file->private_data;
+
+    stats_reset(g);
+
+    return count;
+}
+
+static const struct file_operations program_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .read = program_read,
+    .llseek = default_llseek,
+};
+
+static const struct file_operations verify_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .read = verify_read,
+    .write = verify_write,
+    .llseek = default_llseek,
+};
+
+static const struct file_operations stats_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .read = stats_read,
+    .write = stats_write,
+    .llseek = default_llseek,
+};
+
+int debug_register(struct garage_dev *g)
+{
+    mutex_init(&g->debug_lock);
+
+    g->debug_report = kzalloc(DEBUG_REPORT_SIZE, GFP_KERNEL);
+    if(g->debug_report == NULL)
+        return -ENOMEM;
+    g->debug_len = 0;
+
+    // debugfs is optional, carry on without it
+    g->debug_dir = debugfs_create_dir(DEBUG_DIRNAME, NULL);
+    if(IS_ERR_OR_NULL(g->debug_dir)) {
+        g->debug_dir = NULL;
+        return 0;
+    }
+
+    debugfs_create_file("program", 0444, g->debug_dir, g, &program_fops);
+    debugfs_create_file("verify", 0644, g->debug_dir, g, &verify_fops);
+    debugfs_create_file("stats", 0644, g->debug_dir, g, &stats_fops);
+    debugfs_create_u32("dreq_probe", 0644, g->debug_dir, &g->dreq_probe);
+
+    return 0;
+}
+
+void debug_unregister(struct garage_dev *g)
+{
+    debugfs_remove_recursive(g->debug_dir);
+    g->debug_dir = NULL;
+
+    kfree(g->debug_report);
+    g->debug_report = NULL;
+}
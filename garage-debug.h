@@ -0,0 +1,15 @@
+
+#ifndef __GARAGE_DEBUG_H__
+#define __GARAGE_DEBUG_H__
+
+#define DEBUG_DIRNAME       "garage-door"
+
+// size of the verifier report, enough for a MAX_CBS program
+#define DEBUG_REPORT_SIZE   (32*1024)
+
+struct garage_dev;
+
+int debug_register(struct garage_dev *g);
+void debug_unregister(struct garage_dev *g);
+
+#endif
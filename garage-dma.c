@@ -1,163 +1,182 @@
 
-#include <linux/kernel.h>
-#include <linux/io.h>
-#include <linux/clk.h>
-#include <linux/timekeeping.h>
-#include <linux/interrupt.h>
-
 #include "garage-driver.h"
 #include "garage-dma.h"
 #include "garage-gpio.h"
+#include "garage-pwm.h"
+#include "garage-clk.h"
+
+
+// PWM1 pattern with 'n' carrier cycles (10b) out of AMP_STEPS
+static u32 amp_pattern(int n)
+{
+    u32 word = 0;
+    int i;
 
+    for(i=0;i<AMP_STEPS;i++) {
+        if(i*n % AMP_STEPS < n)
+            word |= BIT(31 - 2*i);
+    }
 
+    return word;
+}
+
+// allocate the main program and the constant words
 int dma_allocate(struct garage_dev *g)
 {
-    dma_cap_mask_t mask;
     u32 *buf;
+    int i;
 
-    g->dma_reg = ioremap(DMA_BASE, SZ_16K);
+    if(g->max_cbs == 0)
+        g->max_cbs = MAX_CBS;
 
-    if(g->dma_reg == NULL) {
-        dev_err(g->dev, "error: failed to ioremap DMA registers\n");
+    if(prog_alloc(g, &g->prog) < 0)
         return -ENOMEM;
-    }
 
-    dma_cap_zero(mask);
-    dma_cap_set(DMA_SLAVE, mask);
-    g->dma_chan = dma_request_channel(mask, NULL, NULL);
-    if(g->dma_chan == NULL) {
-        dev_err(g->dev, "error: DMA request channel failed\n");
-        return -EIO;
-    }
-
-    g->cb_base = dma_alloc_writecombine(g->dev, sizeof(*g->cb_base)*MAX_CBS + 4*4, &g->cb_handle, GFP_KERNEL);
-    if(g->cb_base == NULL) {
-        dev_err(g->dev, "error: dma_alloc_writecombine failed\n");
+    buf = g->buf = g->ops->dma_alloc(g, 4*BUF_WORDS, &g->buf_handle);
+    if(g->buf == NULL) {
+        dev_err(g->dev, "error: failed to allocate DMA buffer\n");
         return -ENOMEM;
     }
 
-    buf = (u32*)(g->cb_base + MAX_CBS);
-    g->buf_handle = g->cb_handle + sizeof(*g->cb_base)*MAX_CBS;
-
     // setup the buffer
-    buf[0] = GPIO_BIT(BUSY_LED_PIN);       // busy led pin
-    buf[1] = 0;             // amplitude == 0
-    buf[2] = 0xaaaaaaaa;    // amplitude == max (1010101010...1010b)
-    buf[3] = 0;             // carrier to sample rate ratio is unknown yet. Set to half of PWM_RNG2 for debugging.
+    buf[BUF_LED] = GPIO_BIT(BUSY_LED_PIN);  // busy led pin
+    buf[BUF_FIFO] = 0;      // carrier to sample rate ratio is unknown yet. Set to half of PWM_RNG2 for debugging.
+    buf[BUF_DONE] = 0;
+    buf[BUF_STAT] = 0;
+    buf[BUF_FSEL(0)] = 0;   // set by garage_prepare() for a second carrier
+    buf[BUF_FSEL(1)] = 0;
 
-    printk(KERN_INFO "Allocated DMA channel %d\n", g->dma_chan->chan_id);
+    // amplitude table, from 0 to max (1010101010...1010b)
+    for(i=0;i<=AMP_STEPS;i++)
+        buf[BUF_AMP(i)] = amp_pattern(i);
 
     return 0;
 }
 
 void dma_release(struct garage_dev *g)
 {
-    if(g->dma_chan_base)
-        dma_reset(g);
+    prog_free(g, &g->prog);
 
-    if(g->dma_chan)
-        dma_release_channel(g->dma_chan);
+    if(g->buf)
+        g->ops->dma_free(g, 4*BUF_WORDS, g->buf, g->buf_handle);
 
-    if(g->cb_base)
-        dma_free_writecombine(g->dev, sizeof(*g->cb_base)*MAX_CBS + 4*4, g->cb_base, g->cb_handle);
+    g->buf = NULL;
+}
+
+// one more chunk of CBs
+static int prog_grow(struct garage_dev *g, struct garage_prog *p)
+{
+    int i = p->max/CB_CHUNK;
 
-    if(g->dma_reg)
-        iounmap(g->dma_reg);
+    if(i == ARRAY_SIZE(p->chunk))
+        return -ENOSPC;
+
+    p->chunk[i] = g->ops->cb_alloc(g, &p->chunk_handle[i]);
+    if(p->chunk[i] == NULL) {
+        dev_err(g->dev, "error: failed to allocate %d CBs\n", CB_CHUNK);
+        return -ENOMEM;
+    }
+
+    p->max += CB_CHUNK;
+
+    return 0;
 }
 
-void dma_reset(struct garage_dev *g)
+// empty the program before building a new one, keeping its chunks
+void prog_reset(struct garage_prog *p)
 {
-    writel(BCM2708_DMA_RESET | BCM2708_DMA_ABORT, g->dma_chan_base + BCM2708_DMA_CS);
-    writel(BCM2708_DMA_INT | BIT(1), g->dma_chan_base + BCM2708_DMA_CS); // clear INT & END
+    p->sample = 0;
+    p->loop = 0;
+    p->loop_next = 0;
+    p->first_dreq = -1;
+    p->add_err = 0;
 }
 
-// bcm2835 dmaengine driver does not support interlived transactions.
-// Here we use a hack to get an exclusive access to the channel registers,
-// while letting dmaengine handle the IRQ for us.
-int start_dummy_tx(struct garage_dev *g)
+// an empty program with the first chunk, so short programs never allocate
+int prog_alloc(struct garage_dev *g, struct garage_prog *p)
 {
-    struct dma_async_tx_descriptor *desc;
-    dma_cookie_t cookie;
-    struct dma_slave_config slave_config = {};
-    dma_addr_t src_ad;
-    int i, err;
-    struct scatterlist sg;
+    p->max = 0;
+    prog_reset(p);
 
-    if((err = dmaengine_terminate_all(g->dma_chan)) < 0) {
-        dev_err(g->dev, "dmaengine_terminate_all failed\n");
-        return err;
-    }
+    return prog_grow(g, p);
+}
 
-    slave_config.dst_addr_width = DMA_SLAVE_BUSWIDTH_4_BYTES;
-    slave_config.dst_addr = 0x7e200028;
-    slave_config.src_maxburst = 1;
-    slave_config.dst_maxburst = 1;
-    slave_config.slave_id = 5;
-    slave_config.direction = DMA_MEM_TO_DEV;
-    slave_config.device_fc = false;
-
-    if (dmaengine_slave_config(g->dma_chan, &slave_config)) {
-        dev_err(g->dev, "failed to configure dma channel\n");
-        return -EINVAL;
-    }
+// free the chunks from 'keep' on
+static void prog_shrink(struct garage_dev *g, struct garage_prog *p, int keep)
+{
+    int i;
 
-    sg_init_table(&sg, 1); // dummy sg, will be ignored
-    sg_dma_address(&sg) = g->cb_handle;
-    sg_dma_len(&sg) = 4;
+    for(i=keep;i<p->max/CB_CHUNK;i++)
+        g->ops->cb_free(g, p->chunk[i], p->chunk_handle[i]);
 
-    // setup a dummy tx, we're only interested in setting up the completion callback
-    desc = dmaengine_prep_slave_sg(
-            g->dma_chan, 
-            &sg, 1, 
-            DMA_MEM_TO_DEV, 
-            DMA_PREP_INTERRUPT);
+    p->max = keep*CB_CHUNK;
+    if(p->sample > p->max)
+        p->sample = 0;
+}
 
-    if (!desc) {
-        dev_err(g->dev, "error: dmaengine_prep_slave_sg failed\n");
-        return -EINVAL;
-    }
+void prog_free(struct garage_dev *g, struct garage_prog *p)
+{
+    prog_shrink(g, p, 0);
+}
 
-    desc->callback = garage_dma_done;
-    desc->callback_param = g;
+// back to the first chunk, the program must not be running
+void prog_trim(struct garage_dev *g, struct garage_prog *p)
+{
+    prog_shrink(g, p, p->max > 0);
+}
 
-    // submit tx, while DREQ is inactive, so we can identify 
-    // hardware channel number and hack our own CBs
-    cookie = dmaengine_submit(desc);
+// index of the CB holding bus address 'addr' and the offset in it, or -1
+int prog_cb_index(const struct garage_prog *p, dma_addr_t addr, u32 *off)
+{
+    u32 pos;
+    int i, n;
 
-    err = dma_submit_error(cookie);
-    if(err) {
-        dev_err(g->dev, "error: dmaengine_submit failed\n");
-        return err;
-    }
+    for(i=0;i<p->max/CB_CHUNK;i++) {
+        pos = addr - p->chunk_handle[i];
+        if(addr < p->chunk_handle[i] || pos >= CB_CHUNK_SIZE)
+            continue;
 
-    g->dma_chan->device->device_issue_pending(g->dma_chan);
-
-    // guess hw channel number by looking for transfer source addess in DMA registers
-    for(i=0;i<15;i++) {
-        g->dma_chan_base = g->dma_reg + i*0x100;
-        src_ad = readl(g->dma_chan_base + BCM2708_DMA_SOURCE_AD);
-        // DMA read is not controled by DREQ, so src address must be already incremeted
-        if(src_ad == g->cb_handle + 4) {
-            printk(KERN_INFO "Detected hw channel %d.\n", i);
-            break;
-        }
-    }
+        n = i*CB_CHUNK + pos/sizeof(struct bcm2708_dma_cb);
+        if(n >= p->sample)
+            return -1;
 
-    if(i == 15) {
-        g->dma_chan_base = NULL;
-        dev_err(g->dev, "error: failed to identify allocated channel\n");
-        return -EINVAL;
+        *off = pos % sizeof(struct bcm2708_dma_cb);
+        return n;
     }
 
-    return 0;
+    return -1;
+}
+
+void dma_reset(struct garage_dev *g)
+{
+    garage_write(g, GARAGE_DMA, BCM2708_DMA_CS, BCM2708_DMA_RESET | BCM2708_DMA_ABORT);
+    garage_write(g, GARAGE_DMA, BCM2708_DMA_CS, BCM2708_DMA_INT | BIT(1)); // clear INT & END
 }
 
-struct bcm2708_dma_cb *add_xfer(struct garage_dev *g, dma_addr_t from, dma_addr_t to, int len)
+void dma_start(struct garage_dev *g, dma_addr_t cb)
 {
-    struct bcm2708_dma_cb *cb = g->cb_base + g->sample;
+    wmb(); // make sure CBs are in memory
+    garage_write(g, GARAGE_DMA, BCM2708_DMA_ADDR, cb);
+    garage_write(g, GARAGE_DMA, BCM2708_DMA_CS, BCM2708_DMA_ACTIVE);
+}
+
+struct bcm2708_dma_cb *add_xfer(struct garage_dev *g, struct garage_prog *p, dma_addr_t from, dma_addr_t to, int len)
+{
+    struct bcm2708_dma_cb *cb;
+
+    if(p->sample >= g->max_cbs) {
+        dev_err(g->dev, "error: program needs more than %d CBs\n", g->max_cbs);
+        p->add_err = -ENOSPC;
+        return NULL;
+    }
+
+    if(p->sample == p->max && (p->add_err = prog_grow(g, p)) < 0)
+        return NULL;
+
+    cb = prog_cb(p, p->sample);
 
-    if(g->sample > 0) {
-        g->cb_base[g->sample-1].next = g->cb_handle + sizeof(*cb)*g->sample;
+    if(p->sample > 0) {
+        prog_cb(p, p->sample-1)->next = prog_cb_addr(p, p->sample);
     }
 
     cb->info = 
@@ -174,12 +193,99 @@ struct bcm2708_dma_cb *add_xfer(struct garage_dev *g, dma_addr_t from, dma_addr_
     cb->pad[0] = 0;
     cb->pad[1] = 0;
 
-    if(g->sample < MAX_CBS) {
-        g->sample++;
-    } else {
-        dev_err(g->dev, "error: out of CBs!\n");
-    }
+    p->sample++;
+
+    return cb;
+}
+
+
+// write 'val' to 'to', the word is kept in the CB's padding
+struct bcm2708_dma_cb *add_imm(struct garage_dev *g, struct garage_prog *p, dma_addr_t to, u32 val)
+{
+    struct bcm2708_dma_cb *cb = add_xfer(g, p, 0, to, 4);
+
+    if(cb == NULL)
+        return NULL;
+
+    cb->src = prog_cb_addr(p, p->sample-1) + offsetof(struct bcm2708_dma_cb, pad);
+    cb->pad[0] = val;
 
     return cb;
 }
 
+// snapshot PWM_STAT into BUF_STAT, at the end of a program before the
+// FIFO drains (see health_check())
+struct bcm2708_dma_cb *add_stat(struct garage_dev *g, struct garage_prog *p)
+{
+    return add_xfer(g, p, PHYS_TO_DMA(PWM_BASE + PWM_STAT), g->buf_handle+4*BUF_STAT, 4);
+}
+
+// switch CARRIER2_PIN to GPCLK0 (second carrier on) or back to an input,
+// with one of the GPFSEL0 words garage_prepare() left in the buffer
+struct bcm2708_dma_cb *add_fsel(struct garage_dev *g, struct garage_prog *p, int on)
+{
+    return add_xfer(g, p, g->buf_handle+4*BUF_FSEL(!!on), PHYS_TO_DMA(GPIO_BASE + GPIO_REG_FSEL(CARRIER2_PIN)), 4);
+}
+
+// feed 'len' copies of the word at 'from' to the PWM FIFO, one word per
+// DREQ (no source increment, no bursts)
+static int add_paced(struct garage_dev *g, struct garage_prog *p, dma_addr_t from, u32 len)
+{
+    struct bcm2708_dma_cb *cb;
+    u32 n;
+
+    for(;len>0;len-=n) {
+        n = len < RUN_MAX_WORDS ? len : RUN_MAX_WORDS;
+
+        cb = add_xfer(g, p, from, PHYS_TO_DMA(PWM_BASE + PWM_FIFO), 4*n);
+        if(cb == NULL)
+            return p->add_err;
+
+        cb->info &= ~(BCM2708_DMA_S_INC | BCM2708_DMA_BURST(0xf));
+        cb->info |= BCM2708_DMA_PER_MAP(5) | BCM2708_DMA_D_DREQ;
+
+        if(p->first_dreq < 0)
+            p->first_dreq = p->sample - 1;
+    }
+
+    return 0;
+}
+
+// wait 'len' full sample rate periods:
+// PWM2 pops one FIFO word per period, the word itself is not used
+int add_wait(struct garage_dev *g, struct garage_prog *p, u32 len)
+{
+    return add_paced(g, p, g->buf_handle+4*BUF_FIFO, len);
+}
+
+// ENGINE_FIFO: serialize 'words' copies of PWM1 pattern 'amp' out of the
+// FIFO, 16 carrier cycles each
+int add_fifo_run(struct garage_dev *g, struct garage_prog *p, int amp, u32 words)
+{
+    return add_paced(g, p, g->buf_handle+4*BUF_AMP(amp), words);
+}
+
+// set PWM1 pattern (amplitude 'amp' of AMP_STEPS) and hold it for 'len' sample periods
+int add_run(struct garage_dev *g, struct garage_prog *p, int amp, u32 len)
+{
+    if(len == 0)
+        return 0;
+
+    // set PWM1 pattern (amplitude)
+    if(add_xfer(g, p, g->buf_handle+4*BUF_AMP(amp), PHYS_TO_DMA(PWM_BASE + PWM_DAT1), 4) == NULL)
+        return p->add_err;
+
+    return add_wait(g, p, len);
+}
+
+// switch the PWM clock to divisor 'div' (a tone) and hold it for 'len' sample periods
+int add_tone_run(struct garage_dev *g, struct garage_prog *p, u32 div, u32 len)
+{
+    if(len == 0)
+        return 0;
+
+    if(add_imm(g, p, PHYS_TO_DMA(CLK_BASE + PWMCLK_DIV), div) == NULL)
+        return p->add_err;
+
+    return add_wait(g, p, len);
+}
@@ -2,21 +2,94 @@
 #ifndef __GARAGE_DMA_H__
 #define __GARAGE_DMA_H__
 
-#include <linux/dmaengine.h>
-#include <linux/dma-mapping.h>
-#include <linux/platform_data/dma-bcm2708.h>
+#include "garage-types.h"
 
 #define PHYS_TO_DMA(x)  (0x7E000000 - BCM2708_PERI_BASE + x)
 
-// reserve this number of DMA control blocks (limits the maximum length of code sequence)
-#define MAX_CBS 600
+// channel register with the bytes left in the current CB
+#define DMA_TXFR_LEN    0x14
+
+// error bits of the channel DEBUG register (write 1 to clear): read
+// last not set, FIFO error, read error
+#define DMA_DEBUG_ERRORS    (BIT(0) | BIT(1) | BIT(2))
+
+// longest FIFO wait (or run of FIFO words) in a single CB, "lite" channels have 16 bit lengths
+#define RUN_MAX_WORDS   0x3fff
+
+// how many times, and how long after the DMA start, garage_probe_dreq()
+// looks for the first DREQ
+#define DREQ_POLL_READS 200
+#define DREQ_POLL_NS    20000
+
+// CBs are allocated in chunks of CB_CHUNK as programs grow. A program
+// takes at most max_cbs of them (limits the maximum number of runs of
+// identical symbols in a code sequence, each run takes two CBs), MAX_CBS
+// by default and CBS_LIMIT at most.
+#define CB_CHUNK        128
+#define CB_CHUNK_SIZE   (CB_CHUNK*sizeof(struct bcm2708_dma_cb))
+#define MAX_CBS         600
+#define CBS_LIMIT       16384
+
+// chunks beyond the first one are freed after this long without transmissions
+#define CB_TRIM_MS      30000
+
+// layout of the constant words following the CBs
+#define BUF_LED     0   // busy led pin bit
+#define BUF_FIFO    1   // dummy PWM2 FIFO word, used for pacing only
+#define BUF_DONE    2   // set by DMA when a stream or repeated frame reaches its end
+#define BUF_AMP(n)  (3 + (n))   // PWM1 pattern for amplitude n/AMP_STEPS
+#define BUF_STAT    BUF_AMP(AMP_STEPS + 1)  // PWM_STAT, copied by DMA after the last run
+#define BUF_FSEL(on)    (BUF_STAT + 1 + (on))   // GPFSEL0 with the second carrier off/on
+#define BUF_WORDS   BUF_FSEL(2)
+
+// PWM1 serializes 32 bits at twice the carrier frequency, so a word holds
+// up to 16 carrier cycles. Amplitude n is a word with n of them, spread
+// evenly: 0, ..., 0x88888888 (8), ..., 0xaaaaaaaa (16)
+#define AMP_STEPS   16
 
 struct garage_dev;
 
+// a chain of DMA control blocks, in chunks that are not contiguous
+struct garage_prog {
+    struct bcm2708_dma_cb *chunk[CBS_LIMIT/CB_CHUNK];
+    dma_addr_t chunk_handle[CBS_LIMIT/CB_CHUNK];
+    int max;                // number of CBs allocated
+    int sample;             // number of CBs used
+    int loop;               // CB ending a repeated frame, 0 if the frame runs once
+    dma_addr_t loop_next;   // its link back to the start of the frame
+    u64 air_ns;             // expected time on air (of one frame, if repeated)
+    int first_dreq;         // first DREQ paced CB, -1 if none yet
+    int add_err;            // why add_xfer() last failed: -ENOSPC (full) or -ENOMEM
+};
+
+// CB 'n' of program 'p'
+static inline struct bcm2708_dma_cb *prog_cb(const struct garage_prog *p, int n)
+{
+    return p->chunk[n/CB_CHUNK] + n%CB_CHUNK;
+}
+
+// bus address of CB 'n' of program 'p'
+static inline dma_addr_t prog_cb_addr(const struct garage_prog *p, int n)
+{
+    return p->chunk_handle[n/CB_CHUNK] + sizeof(struct bcm2708_dma_cb)*(n%CB_CHUNK);
+}
+
 int dma_allocate(struct garage_dev *g);
 void dma_release(struct garage_dev *g);
 void dma_reset(struct garage_dev *g);
-int start_dummy_tx(struct garage_dev *g);
-struct bcm2708_dma_cb *add_xfer(struct garage_dev *g, dma_addr_t from, dma_addr_t to, int len);
+void dma_start(struct garage_dev *g, dma_addr_t cb);
+void prog_reset(struct garage_prog *p);
+int prog_alloc(struct garage_dev *g, struct garage_prog *p);
+void prog_free(struct garage_dev *g, struct garage_prog *p);
+void prog_trim(struct garage_dev *g, struct garage_prog *p);
+int prog_cb_index(const struct garage_prog *p, dma_addr_t addr, u32 *off);
+struct bcm2708_dma_cb *add_xfer(struct garage_dev *g, struct garage_prog *p, dma_addr_t from, dma_addr_t to, int len);
+struct bcm2708_dma_cb *add_imm(struct garage_dev *g, struct garage_prog *p, dma_addr_t to, u32 val);
+int add_wait(struct garage_dev *g, struct garage_prog *p, u32 len);
+int add_fifo_run(struct garage_dev *g, struct garage_prog *p, int amp, u32 words);
+struct bcm2708_dma_cb *add_stat(struct garage_dev *g, struct garage_prog *p);
+struct bcm2708_dma_cb *add_fsel(struct garage_dev *g, struct garage_prog *p, int on);
+int add_run(struct garage_dev *g, struct garage_prog *p, int amp, u32 len);
+int add_tone_run(struct garage_dev *g, struct garage_prog *p, u32 div, u32 len);
 
 #endif
@@ -20,6 +20,14 @@
 #include "garage-pwm.h"
 #include "garage-dma.h"
 #include "garage-clk.h"
+#include "garage-stream.h"
+#include "garage-queue.h"
+#include "garage-preset.h"
+#include "garage-seq.h"
+#include "garage-enc.h"
+#include "garage-bcm.h"
+#include "garage-debug.h"
+#include "garage-sched.h"
 
 #define DRVNAME "garage-door"
 
@@ -27,60 +35,120 @@ static int garage_allocate_resources(struct garage_dev *g)
 {
     int err;
 
-    g->gpio_reg = ioremap(GPIO_BASE, SZ_16K);
-    g->pwm_reg = ioremap(PWM_BASE, SZ_16K);
-    g->clk_reg = ioremap(CLK_BASE, SZ_16K);
+    if((err = bcm_allocate(g)) < 0)
+        return err;
 
     if((err = dma_allocate(g)) < 0)
         return err;
 
+    if((err = bcm_start(g)) < 0)
+        return err;
+
     return 0;
 }
 
 static void garage_release_resources(struct garage_dev *g)
 {
     dma_release(g);
-    iounmap(g->gpio_reg);
-    iounmap(g->pwm_reg);
-    iounmap(g->clk_reg);
+    bcm_release(g);
 }
 
-static void garage_stop(struct garage_dev *g)
+// end of standby, unless a transmission picked the carrier up again
+static void garage_standby_expire(struct work_struct *work)
 {
-    if(g->gpio_reg)
-        gpio_set_mode(g, 18, 1);
+    struct garage_dev *g = container_of(to_delayed_work(work), struct garage_dev, standby_work);
+
+    if(test_and_set_bit(GARAGE_BUSY, &g->flags))
+        return;
 
-    if(g->clk_reg)
-        pwm_clock_stop(g);
+    if(test_bit(GARAGE_WARM, &g->flags))
+        garage_stop(g);
 
-    if(g->pwm_reg)
-        pwm_stop(g);
+    clear_bit(GARAGE_BUSY, &g->flags);
 
-    if(g->dma_chan_base)
-        dma_reset(g);
+    // run jobs queued while we held the transmitter
+    queue_run(g);
 }
 
-void garage_dma_done(void *data)
+// give the CB chunks of a long program back once idle
+static void garage_trim_expire(struct work_struct *work)
 {
-    struct garage_dev *g = data;
-    ktime_t diff = ktime_sub(ktime_get(), g->start_time);
+    struct garage_dev *g = container_of(to_delayed_work(work), struct garage_dev, trim_work);
+
+    if(test_and_set_bit(GARAGE_BUSY, &g->flags))
+        return;
+
+    prog_trim(g, &g->prog);
+
+    clear_bit(GARAGE_BUSY, &g->flags);
+
+    queue_run(g);
+}
+
+// the program on air did not complete in time, give the transmitter back
+static void garage_watchdog_expire(struct work_struct *work)
+{
+    struct garage_dev *g = container_of(to_delayed_work(work), struct garage_dev, watchdog_work);
+
+    // lost the race against the completion interrupt
+    if(!test_and_clear_bit(GARAGE_WATCH, &g->flags))
+        return;
 
+    if(test_bit(GARAGE_STREAMING, &g->flags)) {
+        stream_stop(g, 1);
+        return;
+    }
+
+    health_check(g, 1);
     garage_stop(g);
 
-    g->done = 1;
-    wake_up_interruptible(&g->wq);
+    queue_complete(g, -ETIMEDOUT);
+    queue_run(g);
+}
+
+// expect program 'p' to complete within its time on air (one frame of a
+// repeated program, half the ring of a stream) plus some slack
+void garage_watch(struct garage_dev *g, struct garage_prog *p)
+{
+    unsigned long ms = div_u64(p->air_ns, NSEC_PER_MSEC) + HEALTH_SLACK_MS;
 
-    printk(KERN_INFO "all done: %ld ms\n", (long)ktime_to_ms(diff));
+    set_bit(GARAGE_WATCH, &g->flags);
+    mod_delayed_work(system_wq, &g->watchdog_work, msecs_to_jiffies(ms));
 }
 
-static void outbit(struct garage_dev *g, int bit)
+void garage_dma_done(void *data)
 {
-     // set PWM1 pattern (amplitude)
-    add_xfer(g, g->buf_handle+4+(bit ? 4 : 0), PHYS_TO_DMA(PWM_BASE + PWM_DAT1), 4);
+    struct garage_dev *g = data;
+    unsigned int standby_ms = READ_ONCE(g->standby_ms);
+
+    // end of a repeated frame, the next one is on air
+    if(!garage_repeat_done(g)) {
+        garage_watch(g, g->air);
+        return;
+    }
+
+    // the watchdog gave up on this program already
+    if(!test_and_clear_bit(GARAGE_WATCH, &g->flags))
+        return;
+    cancel_delayed_work(&g->watchdog_work);
+
+    health_check(g, 0);
+    stats_record(g, STAGE_AIR, garage_now(g) - g->start_ns);
+
+    if(standby_ms) {
+        garage_standby(g);
+        mod_delayed_work(system_wq, &g->standby_work, msecs_to_jiffies(standby_ms));
+    } else {
+        garage_stop(g);
+    }
+
+    if(g->prog.max > CB_CHUNK)
+        mod_delayed_work(system_wq, &g->trim_work, msecs_to_jiffies(CB_TRIM_MS));
 
-    // wait 1 full sample rate period
-    add_xfer(g, g->buf_handle+4*3, PHYS_TO_DMA(PWM_BASE + PWM_FIFO), 4)
-        ->info |= BCM2708_DMA_PER_MAP(5) | BCM2708_DMA_D_DREQ; 
+    queue_complete(g, 0);
+
+    // go on with the next job without a round trip to userspace
+    queue_run(g);
 }
 
 static int garage_probe(struct platform_device *pdev)
@@ -92,15 +160,43 @@ static int garage_probe(struct platform_device *pdev)
     platform_set_drvdata(pdev, g);
     g->dev = dev;
     g->dma_chan_base = NULL;
-    g->freq = 0;
-    g->srate = 0;
+    g->params.freq = 0;
+    g->params.srate = 0;
+    g->params.enc = NULL;
+    g->params.levels = 2;
+    mutex_init(&g->params_lock);
     init_waitqueue_head(&g->wq);
+    INIT_DELAYED_WORK(&g->standby_work, garage_standby_expire);
+    INIT_DELAYED_WORK(&g->trim_work, garage_trim_expire);
+    INIT_DELAYED_WORK(&g->watchdog_work, garage_watchdog_expire);
+    stats_init(g);
+    health_init(g);
+    preset_init(g);
+    sched_init(g);
 
     if((err = garage_allocate_resources(g)) < 0) {
         garage_release_resources(g);
         return err;
     }
 
+    if((err = stream_register(g)) < 0) {
+        garage_release_resources(g);
+        return err;
+    }
+
+    if((err = queue_register(g)) < 0) {
+        stream_unregister(g);
+        garage_release_resources(g);
+        return err;
+    }
+
+    if((err = debug_register(g)) < 0) {
+        queue_unregister(g);
+        stream_unregister(g);
+        garage_release_resources(g);
+        return err;
+    }
+
     return 0;
 }
 
@@ -108,10 +204,21 @@ static int garage_remove(struct platform_device *pdev)
 {
     struct garage_dev *g = platform_get_drvdata(pdev);
 
+    debug_unregister(g);
+    queue_unregister(g);
+    stream_unregister(g);
+
     gpio_clear(g, BUSY_LED_PIN);
 
+    sched_cancel(g);
+    cancel_delayed_work_sync(&g->watchdog_work);
     garage_stop(g);
+    cancel_delayed_work_sync(&g->standby_work);
+    cancel_delayed_work_sync(&g->trim_work);
+    cancel_work_sync(&g->queue_work);  // queued by the works above
+    queue_complete(g, -ENODEV);
 
+    preset_cleanup(g);
     garage_release_resources(g);
 
     platform_set_drvdata(pdev, NULL);
@@ -121,56 +228,45 @@ static int garage_remove(struct platform_device *pdev)
     return 0;
 }
 
-static int send_sequence(struct garage_dev *g, const char *code)
+// snapshot of the parameters for a new job. The attribute stores change
+// several fields at once, under the same lock.
+void garage_params_get(struct garage_dev *g, struct garage_params *params)
+{
+    mutex_lock(&g->params_lock);
+    *params = g->params;
+    mutex_unlock(&g->params_lock);
+}
+
+int send_sequence(struct garage_dev *g, const u8 *buf, size_t len)
 {
-    const char *p;
     int err;
 
-    g->done = 0;
-    gpio_set_mode(g, 18, 2);                // pin18 -> PWM out
-    gpio_set_mode(g, BUSY_LED_PIN, 1);      // GPIO out (busy led)
-    gpio_set(g, BUSY_LED_PIN);              // busy led ON
+    // repeated frames interrupt on every round
+    if((err = garage_prepare(g, garage_dma_done, params_repeating(&g->tx))) < 0)
+        return err;
 
-    // set PWM clock to 2x carrier frequency 
-    // (2x, because 101010...1010b serializer pattern divides clock frequency by two)
-    if((err=pwm_clock_init(g, g->freq*2)) < 0) {
+    if((err = compile_sequence(g, &g->prog, &g->tx, buf, len)) < 0) {
         garage_stop(g);
         return err;
     }
 
-    pwm_stop(g);
-
-    pwm_init(g, 0); // start PWM, but keep DREQ low
-
-    if((err = start_dummy_tx(g)) < 0) {
+    if((err = send_program(g, &g->prog)) < 0) {
         garage_stop(g);
         return err;
     }
 
-    g->sample = 0;
-
-    for(p=code;*p;p++) {
-        switch(*p) {
-            case '1':
-                outbit(g, 1);
-                break;
-            case '0':
-                outbit(g, 0);
-                break;
-            default:
-                /* ignore */ ;
-        }
-    }
-
-    add_xfer(g, g->buf_handle, PHYS_TO_DMA(GPIO_BASE + GPIO_REG_CLEAR(BUSY_LED_PIN)), 4)
-        ->info |= BCM2708_DMA_INT_EN;
-
-    dma_reset(g);
+    return 0;
+}
 
-    bcm_dma_start(g->dma_chan_base, g->cb_handle);
-    g->start_time = ktime_get();
+// start a prepared program now, or at the start time of the job on air
+int send_program(struct garage_dev *g, struct garage_prog *p)
+{
+    if(g->job && g->job->at_ns)
+        return sched_arm(g, p, g->job->at_ns);
 
-    pwm_init(g, 1); // restart PWM, enable DMA
+    garage_watch(g, p);
+    garage_fire(g, p);
+    garage_probe_dreq(g, p);
 
     return 0;
 }
@@ -184,7 +280,7 @@ static ssize_t carrier_show(struct device *dev, struct device_attribute *attr, c
         return -EINVAL;
     }
 
-    return scnprintf(buf, PAGE_SIZE, "%d\n", g->freq);
+    return scnprintf(buf, PAGE_SIZE, "%d\n", g->params.freq);
 }
 
 static ssize_t carrier_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
@@ -208,7 +304,9 @@ static ssize_t carrier_store(struct device *dev, struct device_attribute *attr,
         return -EINVAL;
     }
 
-    g->freq = (long)new;
+    mutex_lock(&g->params_lock);
+    g->params.freq = (long)new;
+    mutex_unlock(&g->params_lock);
 
     return count;
 }
@@ -223,7 +321,7 @@ static ssize_t srate_show(struct device *dev, struct device_attribute *attr, cha
         return -EINVAL;
     }
 
-    return scnprintf(buf, PAGE_SIZE, "%d\n", g->srate);
+    return scnprintf(buf, PAGE_SIZE, "%d\n", g->params.srate);
 }
 
 static ssize_t srate_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
@@ -242,12 +340,360 @@ static ssize_t srate_store(struct device *dev, struct device_attribute *attr, co
         return -EINVAL;
     }
 
-    if(new <= 0 || new > g->freq/16) {
+    mutex_lock(&g->params_lock);
+
+    if(new <= 0 || new > g->params.freq/16) {
+        mutex_unlock(&g->params_lock);
         dev_err(g->dev, "error: sample rate frequency out of range\n");
         return -EINVAL;
     }
 
-    g->srate = (long)new;
+    g->params.srate = (long)new;
+
+    mutex_unlock(&g->params_lock);
+
+    return count;
+}
+
+static ssize_t encoding_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+
+    return encoder_list(g->params.enc, buf, PAGE_SIZE);
+}
+
+static ssize_t encoding_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+    const struct garage_encoder *enc = NULL;
+
+    if(!sysfs_streq(buf, "none")) {
+        enc = encoder_find(buf);
+        if(enc == NULL) {
+            dev_err(g->dev, "error: unknown encoding\n");
+            return -EINVAL;
+        }
+    }
+
+    mutex_lock(&g->params_lock);
+    g->params.enc = enc;
+    g->params.repeat = encoder_repeat(&g->params, g->repeat);
+    mutex_unlock(&g->params_lock);
+
+    return count;
+}
+
+static ssize_t levels_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+
+    return scnprintf(buf, PAGE_SIZE, "%d\n", g->params.levels);
+}
+
+static ssize_t levels_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+    int new;
+
+    if(kstrtoint(buf, 0, &new) < 0 || (new != 2 && new != 4 && new != 8)) {
+        dev_err(g->dev, "error: 2, 4 or 8 expected for levels attribute\n");
+        return -EINVAL;
+    }
+
+    mutex_lock(&g->params_lock);
+    g->params.levels = new;
+    mutex_unlock(&g->params_lock);
+
+    return count;
+}
+
+static ssize_t modulation_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+
+    return scnprintf(buf, PAGE_SIZE, g->params.mod == MOD_FSK ? "ask [fsk]\n" : "[ask] fsk\n");
+}
+
+static ssize_t modulation_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+    int err = 0;
+
+    mutex_lock(&g->params_lock);
+
+    if(sysfs_streq(buf, "ask")) {
+        g->params.mod = MOD_ASK;
+    } else if(sysfs_streq(buf, "fsk")) {
+        if(g->params.ntones == 0) {
+            dev_err(g->dev, "error: set the tones attribute first\n");
+            err = -EINVAL;
+        } else {
+            g->params.mod = MOD_FSK;
+        }
+    } else {
+        dev_err(g->dev, "error: ask or fsk expected for modulation attribute\n");
+        err = -EINVAL;
+    }
+
+    mutex_unlock(&g->params_lock);
+
+    return err < 0 ? err : count;
+}
+
+static ssize_t tones_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+    struct garage_params params;
+    int i, n = 0;
+
+    garage_params_get(g, &params);
+
+    for(i=0;i<params.ntones;i++)
+        n += scnprintf(buf + n, PAGE_SIZE - n, i ? " %d" : "%d", params.tones[i]);
+
+    n += scnprintf(buf + n, PAGE_SIZE - n, "\n");
+
+    return n;
+}
+
+// FSK tone frequencies, space separated, one per symbol value
+static ssize_t tones_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+    struct garage_params params;
+    u32 divs[TONES_MAX];
+    const char *p = buf;
+    char *end;
+    long new;
+    int err;
+
+    mutex_lock(&g->params_lock);
+
+    params = g->params;
+    params.ntones = 0;
+
+    for(;;) {
+        p = skip_spaces(p);
+        if(*p == '\0')
+            break;
+
+        new = simple_strtol(p, &end, 0);
+        if(end == p || new <= 0 || new > INT_MAX || params.ntones == TONES_MAX) {
+            dev_err(g->dev, "error: up to %d frequencies expected for tones attribute\n", TONES_MAX);
+            err = -EINVAL;
+            goto out;
+        }
+
+        params.tones[params.ntones++] = new;
+        p = end;
+    }
+
+    if((err = pwm_tone_calc(&params, divs)) < 0) {
+        dev_err(g->dev, "error: 2, 4 or 8 distinct tones sharing the carrier's clock MASH expected\n");
+        goto out;
+    }
+
+    g->params = params;
+
+out:
+    mutex_unlock(&g->params_lock);
+
+    return err < 0 ? err : count;
+}
+
+static ssize_t sweep_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+    struct garage_params params;
+
+    garage_params_get(g, &params);
+
+    if(params.sweep_step == 0)
+        return scnprintf(buf, PAGE_SIZE, "none\n");
+
+    return scnprintf(buf, PAGE_SIZE, "%d %d %d\n", params.sweep_from, params.sweep_to, params.sweep_step);
+}
+
+// carrier sweep "from to step" in Hz, or "none"
+static ssize_t sweep_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+    struct garage_params params;
+    u32 divs[SWEEP_MAX];
+    int err = 0;
+
+    mutex_lock(&g->params_lock);
+
+    params = g->params;
+
+    if(sysfs_streq(buf, "none")) {
+        params.sweep_step = 0;
+    } else if(sscanf(buf, "%d %d %d", &params.sweep_from, &params.sweep_to, &params.sweep_step) != 3) {
+        dev_err(g->dev, "error: \"from to step\" or none expected for sweep attribute\n");
+        err = -EINVAL;
+        goto out;
+    } else if((err = pwm_sweep_calc(&params, divs)) < 0) {
+        dev_err(g->dev, "error: carrier sweep out of range (at most %d steps within %d ppm of the carrier, sharing its clock MASH)\n",
+                SWEEP_MAX, SWEEP_MAX_DRIFT);
+        goto out;
+    }
+
+    params.repeat = encoder_repeat(&params, g->repeat);
+    g->params = params;
+
+out:
+    mutex_unlock(&g->params_lock);
+
+    return err < 0 ? err : count;
+}
+
+static ssize_t standby_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+
+    return scnprintf(buf, PAGE_SIZE, "%u\n", g->standby_ms);
+}
+
+// ms to keep the carrier clock warm after a transmission, 0 stops it right away
+static ssize_t standby_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+    unsigned int new;
+
+    if(kstrtouint(buf, 0, &new) < 0) {
+        dev_err(g->dev, "error: ms expected for standby attribute\n");
+        return -EINVAL;
+    }
+
+    WRITE_ONCE(g->standby_ms, new);
+
+    // an idle carrier is stopped right away, or after the new timeout
+    mod_delayed_work(system_wq, &g->standby_work, msecs_to_jiffies(new));
+
+    return count;
+}
+
+static ssize_t carrier2_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+
+    return scnprintf(buf, PAGE_SIZE, "%d\n", g->params.carrier2);
+}
+
+// second carrier on GPCLK0 (CARRIER2_PIN), keyed along with the first one, 0 = off
+static ssize_t carrier2_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+    u32 ctl, div;
+    int new;
+
+    if(kstrtoint(buf, 0, &new) < 0 || (new != 0 && gpclk_calc(new, &ctl, &div) < 0)) {
+        dev_err(g->dev, "error: %d to %d or 0 expected for carrier2 attribute\n", GPCLK_MIN_FREQ, GPCLK_MAX_FREQ);
+        return -EINVAL;
+    }
+
+    mutex_lock(&g->params_lock);
+    g->params.carrier2 = new;
+    mutex_unlock(&g->params_lock);
+
+    return count;
+}
+
+static ssize_t repeat_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+    int repeat = READ_ONCE(g->params.repeat);
+
+    if(repeat == REPEAT_FOREVER)
+        return scnprintf(buf, PAGE_SIZE, "forever\n");
+
+    return scnprintf(buf, PAGE_SIZE, "%d\n", repeat > 1 ? repeat : 1);
+}
+
+// frames per transmission, "forever" until stopped, or 0 for the default
+// (the line encoder's count, once without one)
+static ssize_t repeat_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+    int new;
+
+    if(sysfs_streq(buf, "forever")) {
+        new = REPEAT_FOREVER;
+    } else if(kstrtoint(buf, 0, &new) < 0 || new < 0) {
+        dev_err(g->dev, "error: count or forever expected for repeat attribute\n");
+        return -EINVAL;
+    }
+
+    mutex_lock(&g->params_lock);
+    g->repeat = new;
+    g->params.repeat = encoder_repeat(&g->params, g->repeat);
+    mutex_unlock(&g->params_lock);
+
+    return count;
+}
+
+// end a repeated transmission after the frame following the one on air,
+// or cancel one waiting for its start time
+static ssize_t stop_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+
+    WRITE_ONCE(g->repeat_left, 1);
+
+    queue_stop(g);
+
+    return count;
+}
+
+static ssize_t engine_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+
+    return scnprintf(buf, PAGE_SIZE, g->params.engine == ENGINE_FIFO ? "paced [fifo]\n" : "[paced] fifo\n");
+}
+
+// how the CBs feed PWM1, see add_run() and add_fifo_run()
+static ssize_t engine_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+    int new;
+
+    if(sysfs_streq(buf, "paced")) {
+        new = ENGINE_PACED;
+    } else if(sysfs_streq(buf, "fifo")) {
+        new = ENGINE_FIFO;
+    } else {
+        dev_err(g->dev, "error: paced or fifo expected for engine attribute\n");
+        return -EINVAL;
+    }
+
+    mutex_lock(&g->params_lock);
+    g->params.engine = new;
+    mutex_unlock(&g->params_lock);
+
+    return count;
+}
+
+static ssize_t max_cbs_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+
+    return scnprintf(buf, PAGE_SIZE, "%d\n", g->max_cbs);
+}
+
+// upper bound of a program, longer ones fail with -ENOSPC
+static ssize_t max_cbs_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+    int new;
+
+    // a stream ring (two CBs per slot and three to end it) must fit
+    if(kstrtoint(buf, 0, &new) < 0 || new < 2*STREAM_SLOTS + 3 || new > CBS_LIMIT) {
+        dev_err(g->dev, "error: %d to %d expected for max_cbs attribute\n", 2*STREAM_SLOTS + 3, CBS_LIMIT);
+        return -EINVAL;
+    }
+
+    WRITE_ONCE(g->max_cbs, new);
 
     return count;
 }
@@ -262,25 +708,64 @@ static ssize_t sequence_store(struct device *dev, struct device_attribute *attr,
         return -EINVAL;
     }
 
-    err = send_sequence(g, buf);
+    err = queue_send(g, buf, count);
     if(err < 0)
         return err;
 
-    err = wait_event_interruptible(g->wq, g->done);
-    if(err < 0)
-        return err;
+    return count;
+}
+
+static ssize_t health_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+
+    return health_print(g, buf, PAGE_SIZE);
+}
+
+// any write clears the counters
+static ssize_t health_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+
+    health_reset(g);
 
     return count;
 }
 
 DEVICE_ATTR(carrier, 0644, carrier_show, carrier_store);
+DEVICE_ATTR(carrier2, 0644, carrier2_show, carrier2_store);
 DEVICE_ATTR(srate, 0644, srate_show, srate_store);
+DEVICE_ATTR(encoding, 0644, encoding_show, encoding_store);
+DEVICE_ATTR(levels, 0644, levels_show, levels_store);
+DEVICE_ATTR(modulation, 0644, modulation_show, modulation_store);
+DEVICE_ATTR(tones, 0644, tones_show, tones_store);
+DEVICE_ATTR(sweep, 0644, sweep_show, sweep_store);
+DEVICE_ATTR(standby, 0644, standby_show, standby_store);
+DEVICE_ATTR(repeat, 0644, repeat_show, repeat_store);
+DEVICE_ATTR(stop, 0200, NULL, stop_store);
+DEVICE_ATTR(engine, 0644, engine_show, engine_store);
+DEVICE_ATTR(max_cbs, 0644, max_cbs_show, max_cbs_store);
 DEVICE_ATTR(sequence, 0644, NULL, sequence_store);
+DEVICE_ATTR(presets, 0644, presets_show, presets_store);
+DEVICE_ATTR(health, 0644, health_show, health_store);
 
 static struct attribute *dev_attrs[] = {
     &dev_attr_carrier.attr,
+    &dev_attr_carrier2.attr,
     &dev_attr_srate.attr,
+    &dev_attr_encoding.attr,
+    &dev_attr_levels.attr,
+    &dev_attr_modulation.attr,
+    &dev_attr_tones.attr,
+    &dev_attr_sweep.attr,
+    &dev_attr_standby.attr,
+    &dev_attr_repeat.attr,
+    &dev_attr_stop.attr,
+    &dev_attr_engine.attr,
+    &dev_attr_max_cbs.attr,
     &dev_attr_sequence.attr,
+    &dev_attr_presets.attr,
+    &dev_attr_health.attr,
     NULL,
 };
 
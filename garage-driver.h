@@ -2,26 +2,184 @@
 #ifndef __GARAGE_DRIVER_H__
 #define __GARAGE_DRIVER_H__
 
+#include "garage-types.h"
+#include "garage-hal.h"
+#include "garage-dma.h"
+#include "garage-stats.h"
+#include "garage-health.h"
+
+#ifdef __KERNEL__
+#include <linux/dmaengine.h>
+#include <linux/kfifo.h>
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#include <linux/refcount.h>
+#endif
+
 #define BUSY_LED_PIN 19
+#define CARRIER2_PIN 4     // GPCLK0 (ALT0), the second carrier
+
+// number of symbols buffered between the stream writer and the CB ring
+#define STREAM_FIFO_SIZE 4096
+
+struct garage_encoder;
+
+// modulation
+#define MOD_ASK     0   // symbols select the carrier amplitude
+#define MOD_FSK     1   // symbols select one of the tones, carrier always on
+
+#define TONES_MAX   8
+
+// garage_params.repeat: loop the frame until stopped
+#define REPEAT_FOREVER  (-1)
+
+// how the CBs feed PWM1
+#define ENGINE_PACED    0   // pattern written to PWM1 data, PWM2 FIFO as the sample clock
+#define ENGINE_FIFO     1   // patterns streamed through the PWM1 FIFO, word by word
+
+// most carrier frequencies in a sweep, each takes two CBs
+#define SWEEP_MAX   64
+
+// sample periods are counted in PWM clocks, so a sweep step f stretches
+// the frame timing by freq/f. Steps further than this from the carrier
+// (in ppm) are rejected.
+#define SWEEP_MAX_DRIFT 10000
+
+// transmission parameters, snapshotted by every job
+struct garage_params {
+    int freq;                           /* carrier frequency */
+    int srate;                          /* sample rate */
+    const struct garage_encoder *enc;   /* line encoder, NULL for raw symbols */
+    int levels;                         /* amplitude levels per symbol: 2, 4 or 8 */
+    int mod;                            /* MOD_ASK or MOD_FSK */
+    int ntones;                         /* FSK: 2, 4 or 8 tones, one per symbol */
+    int tones[TONES_MAX];               /* FSK: tone frequencies */
+    int sweep_from, sweep_to, sweep_step;   /* carrier sweep, off if sweep_step is 0 */
+    int engine;                         /* ENGINE_PACED or ENGINE_FIFO */
+    int repeat;                         /* frames sent, 0 or 1 once, or REPEAT_FOREVER */
+    int carrier2;                       /* second carrier frequency on CARRIER2_PIN, 0 = off */
+};
+
+// the frame is looped on air rather than sent once
+static inline int params_repeating(const struct garage_params *params)
+{
+    return params->repeat > 1 || params->repeat == REPEAT_FOREVER;
+}
+
+// g->flags
+#define GARAGE_BUSY         0   // a transmission is in progress
+#define GARAGE_STREAM_OPEN  1   // stream device is open
+#define GARAGE_STREAMING    2   // stream ring is running
+#define GARAGE_WARM         3   // clock and PWM left running at zero amplitude
+#define GARAGE_WATCH        4   // the watchdog waits for the program on air
+#define GARAGE_CARRIER2     5   // GPCLK0 running for the second carrier
 
 
 struct garage_dev {
     struct device *dev;
+    const struct garage_ops *ops;
 
-    void *pwm_reg, *dma_reg, *dma_chan_base, *gpio_reg, *clk_reg;
+    struct garage_prog prog;            /* DMA control blocks */
+    int max_cbs;                        /* CBs a program may take */
+    dma_addr_t buf_handle;
+    u32 *buf;                           /* constant words used by the CBs */
+    struct garage_params params;        /* parameters for new jobs */
+    int repeat;                         /* repeat attribute, 0 for the encoder's default */
+    struct garage_params tx;            /* parameters on air */
+    u32 tx_clk_ctl, tx_clk_div;         /* PWM clock divisors on air */
+    u32 warm_clk_ctl, warm_clk_div;     /* PWM clock divisors in standby */
+    u32 tx_clk2_ctl, tx_clk2_div;       /* GPCLK0 divisors on air, 0 without a second carrier */
+    u32 warm_clk2_div;                  /* GPCLK0 divisor in standby */
+    u64 start_ns;                       /* DMA start */
+    u64 trigger_ns;                     /* submission of the job on air, 0 if none */
+    struct garage_prog *air;            /* program on air */
+    int repeat_left;                    /* frames left including the one on air, or REPEAT_FOREVER */
+    u32 dreq_probe;                     /* spin for the first DREQ after a start, for the stats */
+    struct garage_stats stats;
+    struct garage_health health;
+    unsigned long flags;
 
+#ifdef __KERNEL__
+    /* hardware, see garage-bcm.c */
+    void *pwm_reg, *dma_reg, *dma_chan_base, *gpio_reg, *clk_reg;
     struct dma_chan *dma_chan;
-    struct bcm2708_dma_cb *cb_base;		/* DMA control blocks */
-    dma_addr_t cb_handle, buf_handle;
-    int sample;
-    int freq;
-    int srate;
-    ktime_t start_time;
+    struct dma_pool *cb_pool;           /* CB chunks */
+    spinlock_t dma_lock;                /* dma_callback, dma_cyclic */
+    garage_callback_t dma_callback;     /* program on air, NULL when done */
+    int dma_cyclic;
+
     wait_queue_head_t wq;
-    int done;
+
+    /* attributes */
+    struct mutex params_lock;           /* params and repeat, see garage_params_get() */
+
+    /* standby */
+    unsigned int standby_ms;            /* keep warm this long after a job, 0 = off */
+    struct delayed_work standby_work;   /* stops the carrier clock */
+    struct delayed_work trim_work;      /* frees CB chunks of the main program */
+    struct delayed_work watchdog_work;  /* stops programs that don't complete */
+
+    /* scheduled start */
+    struct hrtimer sched_timer;
+    struct garage_prog *sched_prog;     /* program armed */
+    u64 sched_ns;                       /* its DMA start */
+
+    /* streaming */
+    struct miscdevice stream_dev;
+    struct mutex stream_lock;
+    wait_queue_head_t stream_wq;
+    DECLARE_KFIFO(stream_fifo, u8, STREAM_FIFO_SIZE);
+    int stream_half;                    /* ring half to be refilled next */
+    int stream_eof;                     /* writer has gone, drain and stop */
+    int stream_ending;                  /* end of stream is linked into the ring */
+
+    /* submission queue */
+    struct miscdevice queue_dev;
+    spinlock_t queue_lock;
+    struct list_head queue;             /* jobs waiting for transmission */
+    int queue_len;
+    wait_queue_head_t queue_wq;         /* room in the queue */
+    struct garage_job *job;             /* job on air */
+    struct work_struct queue_work;      /* starts the next job */
+
+    /* presets */
+    struct list_head presets;
+    spinlock_t preset_lock;             /* list and active counts */
+    struct mutex preset_mutex;          /* serialises updates */
+    wait_queue_head_t preset_wq;
+
+    /* debugfs */
+    struct dentry *debug_dir;
+    struct mutex debug_lock;            /* verifier report */
+    char *debug_report;
+    size_t debug_len;
+#else
+    void *sim;                          /* simulator state, see sim/ */
+#endif
 };
 
 
+// garage-tx.c
+void garage_stop(struct garage_dev *g);
+void garage_standby(struct garage_dev *g);
+int garage_set_tx(struct garage_dev *g, const struct garage_params *params);
+int garage_prepare(struct garage_dev *g, garage_callback_t callback, int cyclic);
+void garage_fire(struct garage_dev *g, struct garage_prog *p);
+void garage_probe_dreq(struct garage_dev *g, struct garage_prog *p);
+int garage_repeat_done(struct garage_dev *g);
+
+#ifdef __KERNEL__
+// garage-driver.c
+void garage_params_get(struct garage_dev *g, struct garage_params *params);
 void garage_dma_done(void *data);
+int send_sequence(struct garage_dev *g, const u8 *buf, size_t len);
+int send_program(struct garage_dev *g, struct garage_prog *p);
+void garage_watch(struct garage_dev *g, struct garage_prog *p);
+#endif
 
 #endif
@@ -0,0 +1,57 @@
+
+#include "garage-driver.h"
+#include "garage-seq.h"
+#include "garage-enc.h"
+
+// Line encoders, the protocols themselves are in garage-proto.c.
+//
+// Runs are emitted straight into the run-length builder, so the expanded
+// sequence is never materialised.
+
+const struct garage_encoder *encoder_find(const char *name)
+{
+    return proto_find(name);
+}
+
+// list encoders, the selected one in brackets
+ssize_t encoder_list(const struct garage_encoder *selected, char *buf, size_t size)
+{
+    const struct garage_encoder *enc;
+    ssize_t n;
+    int i;
+
+    n = scnprintf(buf, size, selected ? "none" : "[none]");
+
+    for(i=0;(enc = proto_encoder(i)) != NULL;i++) {
+        n += scnprintf(buf + n, size - n, selected == enc ? " [%s]" : " %s", enc->name);
+    }
+
+    n += scnprintf(buf + n, size - n, "\n");
+
+    return n;
+}
+
+static int emit_run(void *ctx, int on, unsigned int len)
+{
+    struct garage_builder *b = ctx;
+
+    return builder_emit(b, on ? b->levels - 1 : 0, len);
+}
+
+// frames sent for a repeat attribute of 'repeat', where 0 is the default:
+// the line encoder's own count, or once. A sweep repeats the frame by
+// itself, so it is sent once per step.
+int encoder_repeat(const struct garage_params *params, int repeat)
+{
+    if(repeat == 0 && params->enc && !params->sweep_step)
+        return params->enc->repeat;
+
+    return repeat;
+}
+
+// one part of the transmission (PROTO_FRAME, or the preamble or postamble
+// around the frames), the builder repeats the frame
+int encoder_compile(struct garage_builder *b, const struct garage_encoder *enc, int part, const u8 *code, size_t len)
+{
+    return proto_expand_part(enc, part, code, len, emit_run, b);
+}
@@ -0,0 +1,14 @@
+#ifndef __GARAGE_ENC_H__
+#define __GARAGE_ENC_H__
+
+#include "garage-proto.h"
+
+struct garage_builder;
+struct garage_params;
+
+const struct garage_encoder *encoder_find(const char *name);
+ssize_t encoder_list(const struct garage_encoder *selected, char *buf, size_t size);
+int encoder_repeat(const struct garage_params *params, int repeat);
+int encoder_compile(struct garage_builder *b, const struct garage_encoder *enc, int part, const u8 *code, size_t len);
+
+#endif
@@ -6,6 +6,11 @@
 #define GPIO_REG_SET(x)     (x < 32 ? 0x1c : 0x20)
 #define GPIO_REG_CLEAR(x)   (x < 32 ? 0x28 : 0x2c)
 #define GPIO_BIT(x)         BIT(x < 32 ? x : (x - 32))
+#define GPIO_REG_FSEL(x)    (4*(x/10))
+#define GPIO_FSEL(x, mode)  ((mode) << 3*(x%10))
+
+#define GPIO_MODE_IN        0
+#define GPIO_MODE_ALT0      4
 
 struct garage_dev;
 
@@ -0,0 +1,47 @@
+
+#ifndef __GARAGE_HAL_H__
+#define __GARAGE_HAL_H__
+
+// Hardware abstraction.
+//
+// Everything touching the peripherals goes through struct garage_ops.
+// garage-bcm.c implements it on top of ioremap()ed BCM2708 registers and
+// dmaengine, sim/garage-sim.c models the peripherals in userspace.
+
+// register blocks
+#define GARAGE_GPIO     0
+#define GARAGE_PWM      1
+#define GARAGE_CLK      2
+#define GARAGE_DMA      3   // registers of the claimed DMA channel
+#define GARAGE_NBLOCKS  4
+
+struct garage_dev;
+
+typedef void (*garage_callback_t)(void *data);
+
+struct garage_ops {
+    u32 (*read)(struct garage_dev *g, int block, u32 offset);
+    void (*write)(struct garage_dev *g, int block, u32 offset, u32 val);
+
+    // coherent memory for CBs and the words they transfer
+    void *(*dma_alloc)(struct garage_dev *g, size_t size, dma_addr_t *handle);
+    void (*dma_free)(struct garage_dev *g, size_t size, void *cpu, dma_addr_t handle);
+
+    // a chunk of CB_CHUNK CBs, programs grow by these
+    struct bcm2708_dma_cb *(*cb_alloc)(struct garage_dev *g, dma_addr_t *handle);
+    void (*cb_free)(struct garage_dev *g, struct bcm2708_dma_cb *cpu, dma_addr_t handle);
+
+    // get the DMA channel ready for a new program, 'callback' is called
+    // with 'g' on interrupts raised by the CBs, only on the first one
+    // unless 'cyclic'. Cheap, the channel itself is claimed once.
+    int (*chan_claim)(struct garage_dev *g, garage_callback_t callback, int cyclic);
+
+    // monotonic time in ns
+    u64 (*now)(struct garage_dev *g);
+};
+
+#define garage_read(g, block, offset)           ((g)->ops->read((g), (block), (offset)))
+#define garage_write(g, block, offset, val)     ((g)->ops->write((g), (block), (offset), (val)))
+#define garage_now(g)                           ((g)->ops->now(g))
+
+#endif
@@ -0,0 +1,107 @@
+
+#include "garage-driver.h"
+#include "garage-dma.h"
+#include "garage-pwm.h"
+#include "garage-health.h"
+
+// Transmission health.
+//
+// The PWM and DMA error bits are cleared when a program is started and
+// checked when it ends. FIFO gaps are taken from the copy of PWM_STAT the
+// program makes after its last run (add_stat()): the FIFO always runs dry
+// at the very end, which is not a problem.
+
+void health_init(struct garage_dev *g)
+{
+    spin_lock_init(&g->health.lock);
+    health_reset(g);
+}
+
+void health_reset(struct garage_dev *g)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&g->health.lock, flags);
+    g->health.transmissions = 0;
+    memset(&g->health.total, 0, sizeof(g->health.total));
+    memset(&g->health.last, 0, sizeof(g->health.last));
+    g->health.last_stat = 0;
+    g->health.last_debug = 0;
+    spin_unlock_irqrestore(&g->health.lock, flags);
+}
+
+// clear the error bits before a program starts
+void health_arm(struct garage_dev *g)
+{
+    garage_write(g, GARAGE_PWM, PWM_STAT, PWMSTAT_ERRORS);
+    garage_write(g, GARAGE_DMA, BCM2708_DMA_DEBUG, DMA_DEBUG_ERRORS);
+    g->buf[BUF_STAT] = 0;
+}
+
+static void health_add(struct garage_health_count *c, const struct garage_health_count *d)
+{
+    c->gaps += d->gaps;
+    c->fifo_errors += d->fifo_errors;
+    c->bus_errors += d->bus_errors;
+    c->dma_errors += d->dma_errors;
+    c->timeouts += d->timeouts;
+}
+
+// account for the program that just ended (or timed out), before the
+// channel is reset. Returns 1 if anything went wrong.
+int health_check(struct garage_dev *g, int timeout)
+{
+    struct garage_health_count d;
+    unsigned long flags;
+    u32 stat, debug;
+
+    // gaps are only meaningful up to the snapshot
+    stat = (g->buf[BUF_STAT] | garage_read(g, GARAGE_PWM, PWM_STAT)) & PWMSTAT_ERRORS;
+    stat &= g->buf[BUF_STAT] | ~(PWMSTAT_GAPO1 | PWMSTAT_GAPO2);
+
+    debug = garage_read(g, GARAGE_DMA, BCM2708_DMA_DEBUG) & DMA_DEBUG_ERRORS;
+
+    d.gaps = !!(stat & (PWMSTAT_GAPO1 | PWMSTAT_GAPO2));
+    d.fifo_errors = !!(stat & (PWMSTAT_WERR1 | PWMSTAT_RERR1));
+    d.bus_errors = !!(stat & PWMSTAT_BERR);
+    d.dma_errors = debug || (garage_read(g, GARAGE_DMA, BCM2708_DMA_CS) & BCM2708_DMA_ERR);
+    d.timeouts = !!timeout;
+
+    spin_lock_irqsave(&g->health.lock, flags);
+    g->health.transmissions++;
+    health_add(&g->health.total, &d);
+    g->health.last = d;
+    g->health.last_stat = stat;
+    g->health.last_debug = debug;
+    spin_unlock_irqrestore(&g->health.lock, flags);
+
+    if(!d.gaps && !d.fifo_errors && !d.bus_errors && !d.dma_errors && !d.timeouts)
+        return 0;
+
+    dev_err(g->dev, "error: transmission %s: PWM_STAT 0x%03x, DMA DEBUG 0x%x\n",
+            timeout ? "timed out" : "went wrong", stat, debug);
+
+    return 1;
+}
+
+int health_print(struct garage_dev *g, char *buf, size_t size)
+{
+    struct garage_health h;
+    unsigned long flags;
+    int n = 0;
+
+    spin_lock_irqsave(&g->health.lock, flags);
+    h = g->health;
+    spin_unlock_irqrestore(&g->health.lock, flags);
+
+    n += scnprintf(buf + n, size - n, "%-14s %10s %6s\n", "", "total", "last");
+    n += scnprintf(buf + n, size - n, "%-14s %10llu\n", "transmissions", (unsigned long long)h.transmissions);
+    n += scnprintf(buf + n, size - n, "%-14s %10u %6u\n", "gaps", h.total.gaps, h.last.gaps);
+    n += scnprintf(buf + n, size - n, "%-14s %10u %6u\n", "fifo_errors", h.total.fifo_errors, h.last.fifo_errors);
+    n += scnprintf(buf + n, size - n, "%-14s %10u %6u\n", "bus_errors", h.total.bus_errors, h.last.bus_errors);
+    n += scnprintf(buf + n, size - n, "%-14s %10u %6u\n", "dma_errors", h.total.dma_errors, h.last.dma_errors);
+    n += scnprintf(buf + n, size - n, "%-14s %10u %6u\n", "timeouts", h.total.timeouts, h.last.timeouts);
+    n += scnprintf(buf + n, size - n, "last PWM_STAT 0x%03x, DMA DEBUG 0x%x\n", h.last_stat, h.last_debug);
+
+    return n;
+}
@@ -0,0 +1,33 @@
+
+#ifndef __GARAGE_HEALTH_H__
+#define __GARAGE_HEALTH_H__
+
+// the watchdog allows this much on top of the expected time on air
+#define HEALTH_SLACK_MS     200
+
+// transmissions that ran into each problem
+struct garage_health_count {
+    u32 gaps;               // FIFO ran dry between two words, run timing is off
+    u32 fifo_errors;        // PWM FIFO read or write errors
+    u32 bus_errors;         // PWM bus errors
+    u32 dma_errors;         // DMA channel errors (CS or DEBUG)
+    u32 timeouts;           // no completion interrupt in time
+};
+
+struct garage_health {
+    spinlock_t lock;
+    u64 transmissions;
+    struct garage_health_count total;
+    struct garage_health_count last;    // of the last transmission, 0 or 1 each
+    u32 last_stat, last_debug;          // PWM_STAT and DMA DEBUG error bits
+};
+
+struct garage_dev;
+
+void health_init(struct garage_dev *g);
+void health_reset(struct garage_dev *g);
+void health_arm(struct garage_dev *g);
+int health_check(struct garage_dev *g, int timeout);
+int health_print(struct garage_dev *g, char *buf, size_t size);
+
+#endif
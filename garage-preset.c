@@ -0,0 +1,225 @@
+
+#include <linux/kernel.h>
+#include <linux/io.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/string.h>
+#include <linux/timekeeping.h>
+
+#include "garage-driver.h"
+#include "garage-dma.h"
+#include "garage-clk.h"
+#include "garage-queue.h"
+#include "garage-preset.h"
+#include "garage-seq.h"
+
+// Presets.
+//
+// A preset is compiled once, when it is defined, and its CBs and clock
+// divisors stay resident. Triggering it with "@name" only programs the
+// clock, resets the channel and starts DMA.
+//
+// Writing "name carrier srate sequence" to the 'presets' attribute defines
+// (or replaces) a preset, "-name" deletes it. Reading lists the presets.
+
+static struct garage_preset *preset_find(struct garage_dev *g, const char *name)
+{
+    struct garage_preset *preset;
+
+    list_for_each_entry(preset, &g->presets, list) {
+        if(strcmp(preset->name, name) == 0)
+            return preset;
+    }
+
+    return NULL;
+}
+
+static int preset_idle(struct garage_dev *g, struct garage_preset *preset)
+{
+    unsigned long flags;
+    int ret;
+
+    spin_lock_irqsave(&g->preset_lock, flags);
+    ret = preset->active == 0;
+    spin_unlock_irqrestore(&g->preset_lock, flags);
+
+    return ret;
+}
+
+static void preset_free(struct garage_dev *g, struct garage_preset *preset)
+{
+    wait_event(g->preset_wq, preset_idle(g, preset));
+
+    prog_free(g, &preset->prog);
+    kfree(preset);
+}
+
+static struct garage_preset *preset_compile(struct garage_dev *g, const char *name, const struct garage_params *params, const u8 *buf, size_t len)
+{
+    struct garage_preset *preset;
+    int err;
+
+    if(params->srate <= 0 || params->srate > params->freq/16)
+        return ERR_PTR(-EINVAL);
+
+    preset = kzalloc(sizeof(*preset), GFP_KERNEL);
+    if(preset == NULL)
+        return ERR_PTR(-ENOMEM);
+
+    strlcpy(preset->name, name, sizeof(preset->name));
+    preset->params = *params;
+
+    if((err = pwm_clock_calc(params->freq*2, &preset->clk_ctl, &preset->clk_div)) < 0)
+        goto fail;
+
+    if((err = prog_alloc(g, &preset->prog)) < 0)
+        goto fail;
+
+    if((err = compile_sequence(g, &preset->prog, params, buf, len)) < 0) {
+        prog_free(g, &preset->prog);
+        goto fail;
+    }
+
+    return preset;
+
+fail:
+    kfree(preset);
+    return ERR_PTR(err);
+}
+
+// trigger the preset named by the job
+int preset_send(struct garage_dev *g, struct garage_job *job)
+{
+    struct garage_preset *preset;
+    char name[PRESET_NAME_LEN];
+    unsigned long flags;
+    int err;
+
+    if(sscanf((const char *)job->seq + 1, "%31s", name) != 1)
+        return -EINVAL;
+
+    spin_lock_irqsave(&g->preset_lock, flags);
+    preset = preset_find(g, name);
+    if(preset)
+        preset->active++;
+    spin_unlock_irqrestore(&g->preset_lock, flags);
+
+    if(preset == NULL)
+        return -ENOENT;
+
+    g->tx = preset->params;
+    g->tx_clk_ctl = preset->clk_ctl;
+    g->tx_clk_div = preset->clk_div;
+
+    if((err = garage_prepare(g, garage_dma_done, params_repeating(&g->tx))) < 0) {
+        preset_put(g, preset);
+        return err;
+    }
+
+    job->preset = preset;
+
+    if((err = send_program(g, &preset->prog)) < 0) {
+        job->preset = NULL;
+        garage_stop(g);
+        preset_put(g, preset);
+        return err;
+    }
+
+    return 0;
+}
+
+void preset_put(struct garage_dev *g, struct garage_preset *preset)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&g->preset_lock, flags);
+    preset->active--;
+    spin_unlock_irqrestore(&g->preset_lock, flags);
+
+    wake_up(&g->preset_wq);
+}
+
+ssize_t presets_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+    struct garage_preset *preset;
+    ssize_t n = 0;
+
+    mutex_lock(&g->preset_mutex);
+
+    list_for_each_entry(preset, &g->presets, list) {
+        n += scnprintf(buf + n, PAGE_SIZE - n, "%s %d %d %d\n",
+                preset->name, preset->params.freq, preset->params.srate, preset->prog.sample);
+    }
+
+    mutex_unlock(&g->preset_mutex);
+
+    return n;
+}
+
+ssize_t presets_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct garage_dev *g = dev_get_drvdata(dev);
+    struct garage_preset *preset, *old;
+    char name[PRESET_NAME_LEN];
+    unsigned long flags;
+    struct garage_params params;
+    int n;
+
+    if(buf[0] == '-') {
+        if(sscanf(buf + 1, "%31s", name) != 1)
+            return -EINVAL;
+
+        preset = NULL;
+    } else {
+        // line encoding is taken from the device
+        garage_params_get(g, &params);
+
+        if(sscanf(buf, "%31s %d %d %n", name, &params.freq, &params.srate, &n) != 3) {
+            dev_err(g->dev, "error: 'name carrier srate sequence' expected\n");
+            return -EINVAL;
+        }
+
+        preset = preset_compile(g, name, &params, (const u8 *)buf + n, count - n);
+        if(IS_ERR(preset))
+            return PTR_ERR(preset);
+    }
+
+    mutex_lock(&g->preset_mutex);
+
+    spin_lock_irqsave(&g->preset_lock, flags);
+    old = preset_find(g, name);
+    if(old)
+        list_del(&old->list);
+    if(preset)
+        list_add_tail(&preset->list, &g->presets);
+    spin_unlock_irqrestore(&g->preset_lock, flags);
+
+    mutex_unlock(&g->preset_mutex);
+
+    if(old)
+        preset_free(g, old);
+    else if(preset == NULL)
+        return -ENOENT;
+
+    return count;
+}
+
+void preset_init(struct garage_dev *g)
+{
+    INIT_LIST_HEAD(&g->presets);
+    spin_lock_init(&g->preset_lock);
+    mutex_init(&g->preset_mutex);
+    init_waitqueue_head(&g->preset_wq);
+}
+
+void preset_cleanup(struct garage_dev *g)
+{
+    struct garage_preset *preset, *tmp;
+
+    list_for_each_entry_safe(preset, tmp, &g->presets, list) {
+        list_del(&preset->list);
+        preset_free(g, preset);
+    }
+}
@@ -0,0 +1,31 @@
+
+#ifndef __GARAGE_PRESET_H__
+#define __GARAGE_PRESET_H__
+
+#define PRESET_NAME_LEN     32
+
+// a sequence starting with this character names a preset
+#define PRESET_PREFIX       '@'
+
+struct garage_dev;
+struct garage_job;
+
+// compiled transmission program, resident in DMA memory
+struct garage_preset {
+    struct list_head list;
+    char name[PRESET_NAME_LEN];
+    struct garage_params params;
+    u32 clk_ctl, clk_div;       // precomputed PWMCLK_CNTL/PWMCLK_DIV
+    struct garage_prog prog;
+    int active;                 // jobs on air, protected by preset_lock
+};
+
+void preset_init(struct garage_dev *g);
+void preset_cleanup(struct garage_dev *g);
+int preset_send(struct garage_dev *g, struct garage_job *job);
+void preset_put(struct garage_dev *g, struct garage_preset *preset);
+
+ssize_t presets_show(struct device *dev, struct device_attribute *attr, char *buf);
+ssize_t presets_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+
+#endif
@@ -0,0 +1,189 @@
+
+#include "garage-proto.h"
+
+// Built-in remote protocols.
+//
+// Codes are expanded into runs of equal symbols, so a consumer never sees
+// the symbol-by-symbol sequence.
+
+// 0 = 101, 1 = 100, framed like test.sh and userspace/door.c
+static const char *const triplet_patterns[] = { "101", "100" };
+
+// IEEE 802.3: 0 = high-low, 1 = low-high
+static const char *const manchester_patterns[] = { "10", "01" };
+
+// PT2262 style PWM-tristate: 0, 1 and F(loating)
+static const char *const tristate_patterns[] = { "10001000", "11101110", "10001110" };
+
+static const struct garage_encoder encoders[] = {
+    {
+        .name       = "triplet",
+        .symbols    = "01",
+        .patterns   = triplet_patterns,
+        .preamble   = "1111",
+        .prefix     = "101",
+        .suffix     = "10111111",
+        .postamble  = "0",
+        .repeat     = 5,
+    },
+    {
+        .name       = "manchester",
+        .symbols    = "01",
+        .patterns   = manchester_patterns,
+        .preamble   = "",
+        .prefix     = "",
+        .suffix     = "00000000",
+        .postamble  = "0",
+        .repeat     = 5,
+    },
+    {
+        .name       = "tristate",
+        .symbols    = "01F",
+        .patterns   = tristate_patterns,
+        .preamble   = "",
+        .prefix     = "",
+        .suffix     = "10000000000000000000000000000000", // sync
+        .postamble  = "0",
+        .repeat     = 5,
+    },
+};
+
+#define NENCODERS   (int)(sizeof(encoders)/sizeof(encoders[0]))
+
+// pending run of the expansion
+struct proto_run {
+    proto_emit_fn emit;
+    void *ctx;
+    int on;
+    unsigned int len;
+};
+
+const struct garage_encoder *proto_encoder(int i)
+{
+    return i >= 0 && i < NENCODERS ? &encoders[i] : 0;
+}
+
+// 'name' may end with a newline, as written to sysfs
+const struct garage_encoder *proto_find(const char *name)
+{
+    const char *a, *b;
+    int i;
+
+    for(i=0;i<NENCODERS;i++) {
+        for(a=name,b=encoders[i].name;*a && *a == *b;a++,b++)
+            ;
+
+        if(*b == '\0' && (*a == '\0' || (*a == '\n' && a[1] == '\0')))
+            return &encoders[i];
+    }
+
+    return 0;
+}
+
+static int run_push(struct proto_run *r, int on)
+{
+    int err;
+
+    if(r->len > 0 && on != r->on) {
+        if((err = r->emit(r->ctx, r->on, r->len)) < 0)
+            return err;
+        r->len = 0;
+    }
+
+    r->on = on;
+    r->len++;
+
+    return 0;
+}
+
+static int run_pattern(struct proto_run *r, const char *pattern)
+{
+    int err;
+
+    for(;*pattern;pattern++) {
+        if((err = run_push(r, *pattern == '1')) < 0)
+            return err;
+    }
+
+    return 0;
+}
+
+static int run_code(struct proto_run *r, const struct garage_encoder *enc, const unsigned char *code, unsigned long len)
+{
+    const char *sym;
+    unsigned long i;
+    int c, err;
+
+    for(i=0;i<len && code[i];i++) {
+        c = code[i];
+        if(c == ' ' || (c >= '\t' && c <= '\r'))
+            continue;
+        if(c >= 'a' && c <= 'z')
+            c -= 'a' - 'A';
+
+        for(sym=enc->symbols;*sym && *sym != c;sym++)
+            ;
+        if(*sym == '\0')
+            return PROTO_EINVAL;
+
+        if((err = run_pattern(r, enc->patterns[sym - enc->symbols])) < 0)
+            return err;
+    }
+
+    return 0;
+}
+
+static int run_frame(struct proto_run *r, const struct garage_encoder *enc, const unsigned char *code, unsigned long len)
+{
+    int err;
+
+    if((err = run_pattern(r, enc->prefix)) < 0)
+        return err;
+
+    if((err = run_code(r, enc, code, len)) < 0)
+        return err;
+
+    return run_pattern(r, enc->suffix);
+}
+
+// expand 'code' with protocol 'enc' into runs passed to 'emit', all of
+// its 'repeat' frames
+int proto_expand(const struct garage_encoder *enc, const unsigned char *code, unsigned long len,
+        proto_emit_fn emit, void *ctx)
+{
+    struct proto_run r = { emit, ctx, 0, 0 };
+    int i, err;
+
+    if((err = run_pattern(&r, enc->preamble)) < 0)
+        return err;
+
+    for(i=0;i<enc->repeat;i++) {
+        if((err = run_frame(&r, enc, code, len)) < 0)
+            return err;
+    }
+
+    if((err = run_pattern(&r, enc->postamble)) < 0)
+        return err;
+
+    return r.len > 0 ? emit(ctx, r.on, r.len) : 0;
+}
+
+// expand one part of the transmission (PROTO_PREAMBLE, PROTO_FRAME or
+// PROTO_POSTAMBLE), 'code' is only used by the frame
+int proto_expand_part(const struct garage_encoder *enc, int part, const unsigned char *code, unsigned long len,
+        proto_emit_fn emit, void *ctx)
+{
+    struct proto_run r = { emit, ctx, 0, 0 };
+    int err;
+
+    if(part == PROTO_PREAMBLE)
+        err = run_pattern(&r, enc->preamble);
+    else if(part == PROTO_POSTAMBLE)
+        err = run_pattern(&r, enc->postamble);
+    else
+        err = run_frame(&r, enc, code, len);
+    if(err < 0)
+        return err;
+
+    return r.len > 0 ? emit(ctx, r.on, r.len) : 0;
+}
@@ -0,0 +1,40 @@
+#ifndef __GARAGE_PROTO_H__
+#define __GARAGE_PROTO_H__
+
+// Remote protocols, shared by the kernel module, the simulator and
+// userspace/door.c. Freestanding: no kernel or libc headers, so it can be
+// linked anywhere.
+
+// returned for a character the protocol does not know, same value as -EINVAL
+#define PROTO_EINVAL    (-22)
+
+// Line encoder: expands a switch code into carrier on/off symbols.
+// Patterns are strings of '0'/'1' symbols.
+struct garage_encoder {
+    const char *name;
+    const char *symbols;                // accepted code characters
+    const char *const *patterns;        // pattern for each code character
+    const char *preamble;               // once, before the first frame
+    const char *prefix;                 // before the code in each frame
+    const char *suffix;                 // after the code in each frame
+    const char *postamble;              // once, after the last frame
+    int repeat;                         // number of frames (the driver's default repeat)
+};
+
+// parts of an encoded transmission, for consumers repeating the frame themselves
+#define PROTO_PREAMBLE  0   // once, before the first frame
+#define PROTO_FRAME     1   // prefix, code and suffix
+#define PROTO_POSTAMBLE 2   // once, after the last frame
+
+// receives runs of 'len' symbols, 'on' is carrier on, a negative return
+// stops the expansion
+typedef int (*proto_emit_fn)(void *ctx, int on, unsigned int len);
+
+const struct garage_encoder *proto_encoder(int i);
+const struct garage_encoder *proto_find(const char *name);
+int proto_expand(const struct garage_encoder *enc, const unsigned char *code, unsigned long len,
+        proto_emit_fn emit, void *ctx);
+int proto_expand_part(const struct garage_encoder *enc, int part, const unsigned char *code, unsigned long len,
+        proto_emit_fn emit, void *ctx);
+
+#endif
@@ -16,6 +16,7 @@
 #define PWMCTRL_PWEN1   BIT(0)
 #define PWMCTRL_MODE1   BIT(1)
 #define PWMCTRL_RPTL1   BIT(2)
+#define PWMCTRL_USEF1   BIT(5)
 #define PWMCTRL_CLRF    BIT(6)
 #define PWMCTRL_PWEN2   BIT(8)
 #define PWMCTRL_RPTL2   BIT(10)
@@ -24,6 +25,24 @@
 
 #define PWMDMAC_ENAB    BIT(31)
 
+// PWM_STAT, the error bits are write 1 to clear
+#define PWMSTAT_WERR1   BIT(2)  // FIFO write while full
+#define PWMSTAT_RERR1   BIT(3)  // FIFO read while empty
+#define PWMSTAT_GAPO1   BIT(4)  // channel 1 ran out of FIFO words between two
+#define PWMSTAT_GAPO2   BIT(5)  // channel 2 ran out of FIFO words between two
+#define PWMSTAT_BERR    BIT(8)  // bus error writing the registers
+#define PWMSTAT_ERRORS  (PWMSTAT_WERR1 | PWMSTAT_RERR1 | PWMSTAT_GAPO1 | PWMSTAT_GAPO2 | PWMSTAT_BERR)
+
+// ENGINE_FIFO: DREQ threshold, and the zero words ending a program so the
+// last run is out of the FIFO by the final interrupt
+#define FIFO_DREQ_WORDS 7
+#define FIFO_TAIL_WORDS 8
+
+// ENGINE_PACED: FIFO words queued ahead of the sample on air, one in the
+// FIFO (DREQ threshold 1) and one in the PWM2 serializer. Amplitude writes
+// take effect this many samples before the words they follow run out.
+#define PACED_LEAD_WORDS 2
+
 struct garage_dev;
 
 void pwm_stop(struct garage_dev *g);
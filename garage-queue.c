@@ -0,0 +1,601 @@
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/io.h>
+#include <linux/slab.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/uaccess.h>
+#include <linux/timekeeping.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/workqueue.h>
+
+#include "garage-driver.h"
+#include "garage-queue.h"
+#include "garage-uapi.h"
+#include "garage-preset.h"
+#include "garage-sched.h"
+
+// Submission queue.
+//
+// Sequences are queued as jobs and transmitted one after another. The DMA
+// completion callback only completes the job on air, the next one is
+// parsed, compiled and started from a work item (queue_run()), so
+// back-to-back jobs don't wait for the submitter to come back and the
+// callback doesn't sleep or take long. Clients of /dev/garage-door
+// submit with write() and collect results with poll()/read(), the sysfs
+// 'sequence' attribute submits a job and waits for its result.
+// A sequence of the form "@name" triggers a preset. Sequences may also be
+// left in a buffer mmap()ed by the client (one per open file) and queued in
+// place with an ioctl, without copying or writing them.
+
+static void client_init(struct garage_client *c, struct garage_dev *g)
+{
+    c->g = g;
+    INIT_LIST_HEAD(&c->done);
+    init_waitqueue_head(&c->wq);
+    c->next_id = 0;
+    c->map = NULL;
+}
+
+// may be called from queue_complete() in interrupt context, vfree()
+// defers the unmapping then
+static void map_put(struct garage_map *map)
+{
+    if(map && refcount_dec_and_test(&map->ref)) {
+        vfree(map->buf);
+        kfree(map);
+    }
+}
+
+static void job_free(struct garage_job *job)
+{
+    map_put(job->map);
+    kfree(job);
+}
+
+static int client_has_done(struct garage_client *c)
+{
+    unsigned long flags;
+    int ret;
+
+    spin_lock_irqsave(&c->g->queue_lock, flags);
+    ret = !list_empty(&c->done);
+    spin_unlock_irqrestore(&c->g->queue_lock, flags);
+
+    return ret;
+}
+
+// the job on air was taken back before its start time (sched_disarm())
+static void queue_disarmed(struct garage_dev *g)
+{
+    garage_stop(g);
+    queue_complete(g, -ECANCELED);
+    queue_run(g);
+}
+
+// drop the job on air if it is still waiting for its start time
+void queue_stop(struct garage_dev *g)
+{
+    unsigned long flags;
+    int disarmed;
+
+    spin_lock_irqsave(&g->queue_lock, flags);
+    disarmed = g->job && g->job->at_ns && sched_disarm(g);
+    spin_unlock_irqrestore(&g->queue_lock, flags);
+
+    if(disarmed)
+        queue_disarmed(g);
+}
+
+// cancel client's queued jobs and drop the results it hasn't read
+static void client_detach(struct garage_client *c)
+{
+    struct garage_dev *g = c->g;
+    struct garage_job *job, *tmp;
+    unsigned long flags;
+    int disarmed = 0;
+    LIST_HEAD(dead);
+
+    spin_lock_irqsave(&g->queue_lock, flags);
+
+    list_for_each_entry_safe(job, tmp, &g->queue, list) {
+        if(job->owner == c) {
+            list_move_tail(&job->list, &dead);
+            g->queue_len--;
+        }
+    }
+
+    // job on air is freed on completion, one still waiting for its start
+    // time is not sent at all
+    if(g->job && g->job->owner == c) {
+        g->job->owner = NULL;
+        disarmed = g->job->at_ns && sched_disarm(g);
+    }
+
+    list_splice_init(&c->done, &dead);
+
+    spin_unlock_irqrestore(&g->queue_lock, flags);
+
+    wake_up_interruptible(&g->queue_wq);
+
+    if(disarmed)
+        queue_disarmed(g);
+
+    list_for_each_entry_safe(job, tmp, &dead, list)
+        job_free(job);
+}
+
+static void queue_start(struct garage_dev *g);
+
+static struct garage_job *job_alloc(struct garage_client *c, size_t count)
+{
+    struct garage_job *job;
+
+    if(count > QUEUE_MAX_SEQ)
+        return ERR_PTR(-EFBIG);
+
+    job = kmalloc(sizeof(*job) + count + 1, GFP_KERNEL);
+    if(job == NULL)
+        return ERR_PTR(-ENOMEM);
+
+    job->owner = c;
+    job->preset = NULL;
+    job->status = 0;
+    job->duration_ns = 0;
+    job->at_ns = 0;
+    job->start_error_ns = 0;
+    job->data = job->seq;
+    job->map = NULL;
+    job->len = count;
+    job->seq[count] = 0;
+
+    return job;
+}
+
+// queue 'job', returns its number
+static int queue_submit(struct garage_dev *g, struct garage_job *job, int nonblock)
+{
+    unsigned long flags;
+    int err, id;
+
+    garage_params_get(g, &job->params);
+
+    // presets carry their own carrier and sample rate
+    if(job->seq[0] != PRESET_PREFIX && (job->params.freq == 0 || job->params.srate == 0)) {
+        dev_err(g->dev, "error: carrier and srate must be set first\n");
+        return -EINVAL;
+    }
+
+    for(;;) {
+        spin_lock_irqsave(&g->queue_lock, flags);
+
+        if(g->queue_len < QUEUE_MAX_JOBS) {
+            id = job->id = ++job->owner->next_id;
+            list_add_tail(&job->list, &g->queue);
+            g->queue_len++;
+            spin_unlock_irqrestore(&g->queue_lock, flags);
+            break;
+        }
+
+        spin_unlock_irqrestore(&g->queue_lock, flags);
+
+        if(nonblock)
+            return -EAGAIN;
+
+        err = wait_event_interruptible(g->queue_wq, READ_ONCE(g->queue_len) < QUEUE_MAX_JOBS);
+        if(err < 0)
+            return err;
+    }
+
+    queue_start(g);
+
+    return id;
+}
+
+// start the next queued job unless the transmitter is busy, in process
+// context
+static void queue_start(struct garage_dev *g)
+{
+    struct garage_job *job;
+    unsigned long flags;
+    int err;
+
+    for(;;) {
+        spin_lock_irqsave(&g->queue_lock, flags);
+
+        if(list_empty(&g->queue) || test_and_set_bit(GARAGE_BUSY, &g->flags)) {
+            spin_unlock_irqrestore(&g->queue_lock, flags);
+            return;
+        }
+
+        job = list_first_entry(&g->queue, struct garage_job, list);
+        list_del(&job->list);
+        g->queue_len--;
+        g->job = job;
+
+        spin_unlock_irqrestore(&g->queue_lock, flags);
+
+        wake_up_interruptible(&g->queue_wq);
+
+        stats_record(g, STAGE_QUEUE, garage_now(g) - job->submit_ns);
+        g->trigger_ns = job->submit_ns;
+
+        // garage_dma_done() completes the job and starts the next one
+        if(job->seq[0] == PRESET_PREFIX)
+            err = preset_send(g, job);
+        else if((err = garage_set_tx(g, &job->params)) == 0)
+            err = send_sequence(g, job->data, job->len);
+
+        if(err == 0)
+            return;
+
+        queue_complete(g, err);
+    }
+}
+
+static void queue_work_fn(struct work_struct *work)
+{
+    queue_start(container_of(work, struct garage_dev, queue_work));
+}
+
+// start the next queued job from a work item, safe in atomic context
+void queue_run(struct garage_dev *g)
+{
+    queue_work(system_highpri_wq, &g->queue_work);
+}
+
+// report the result of the job on air and release the transmitter
+void queue_complete(struct garage_dev *g, int status)
+{
+    struct garage_job *job;
+    unsigned long flags;
+
+    spin_lock_irqsave(&g->queue_lock, flags);
+
+    job = g->job;
+    g->job = NULL;
+
+    if(job) {
+        if(job->preset)
+            preset_put(g, job->preset);
+
+        job->status = status;
+        job->done_ns = garage_now(g);
+        if(status == 0)
+            job->duration_ns = job->done_ns - g->start_ns;
+
+        if(job->owner) {
+            list_add_tail(&job->list, &job->owner->done);
+            wake_up_interruptible(&job->owner->wq);
+        } else {
+            job_free(job);
+        }
+    }
+
+    clear_bit(GARAGE_BUSY, &g->flags);
+
+    spin_unlock_irqrestore(&g->queue_lock, flags);
+}
+
+// submit a sequence and wait for it to go on air
+int queue_send(struct garage_dev *g, const char *buf, size_t count)
+{
+    struct garage_client c;
+    struct garage_job *job;
+    u64 submit_ns = garage_now(g);
+    int err;
+
+    client_init(&c, g);
+
+    job = job_alloc(&c, count);
+    if(IS_ERR(job))
+        return PTR_ERR(job);
+
+    job->submit_ns = submit_ns;
+    memcpy(job->seq, buf, count);
+
+    if((err = queue_submit(g, job, 0)) < 0) {
+        job_free(job);
+        return err;
+    }
+
+    err = wait_event_interruptible(c.wq, client_has_done(&c));
+    if(err == 0) {
+        stats_record(g, STAGE_WAKE, garage_now(g) - job->done_ns);
+        err = job->status;
+    }
+
+    client_detach(&c);
+
+    return err;
+}
+
+static int queue_open(struct inode *inode, struct file *file)
+{
+    struct garage_dev *g = container_of(file->private_data, struct garage_dev, queue_dev);
+    struct garage_client *c = kmalloc(sizeof(*c), GFP_KERNEL);
+
+    if(c == NULL)
+        return -ENOMEM;
+
+    client_init(c, g);
+    file->private_data = c;
+
+    return nonseekable_open(inode, file);
+}
+
+static int queue_release(struct inode *inode, struct file *file)
+{
+    struct garage_client *c = file->private_data;
+
+    client_detach(c);
+    map_put(c->map);
+    kfree(c);
+
+    return 0;
+}
+
+static ssize_t queue_write(struct file *file, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+    struct garage_client *c = file->private_data;
+    struct garage_job *job;
+    u64 submit_ns = garage_now(c->g);
+    int err;
+
+    job = job_alloc(c, count);
+    if(IS_ERR(job))
+        return PTR_ERR(job);
+
+    job->submit_ns = submit_ns;
+
+    if(copy_from_user(job->seq, ubuf, count)) {
+        job_free(job);
+        return -EFAULT;
+    }
+
+    if((err = queue_submit(c->g, job, file->f_flags & O_NONBLOCK)) < 0) {
+        job_free(job);
+        return err;
+    }
+
+    return count;
+}
+
+// submit a sequence to go on air at a given time
+static int queue_submit_at(struct garage_client *c, void __user *arg, int nonblock)
+{
+    struct garage_timed timed;
+    struct garage_job *job;
+    u64 submit_ns = garage_now(c->g), at_ns, offset;
+    int err;
+
+    if(copy_from_user(&timed, arg, sizeof(timed)))
+        return -EFAULT;
+
+    if(timed.flags & ~GARAGE_TIMED_TAI)
+        return -EINVAL;
+
+    // the timer runs on the monotonic clock
+    at_ns = timed.start_ns;
+    if(timed.flags & GARAGE_TIMED_TAI) {
+        offset = ktime_get_clocktai_ns() - ktime_get_ns();
+        if(at_ns <= offset)
+            return -EINVAL;
+        at_ns -= offset;
+    }
+
+    // the transmitter is held until then
+    if(at_ns == 0 || at_ns > submit_ns + SCHED_MAX_AHEAD_NS)
+        return -EINVAL;
+
+    job = job_alloc(c, timed.len);
+    if(IS_ERR(job))
+        return PTR_ERR(job);
+
+    job->submit_ns = submit_ns;
+    job->at_ns = at_ns;
+
+    if(copy_from_user(job->seq, u64_to_user_ptr(timed.seq), timed.len)) {
+        job_free(job);
+        return -EFAULT;
+    }
+
+    if((err = queue_submit(c->g, job, nonblock)) < 0)
+        job_free(job);
+
+    return err;
+}
+
+// submit a sequence from the mapped buffer
+static int queue_kick(struct garage_client *c, void __user *arg, int nonblock)
+{
+    struct garage_kick kick;
+    struct garage_job *job;
+    u64 submit_ns = garage_now(c->g);
+    int err;
+
+    if(copy_from_user(&kick, arg, sizeof(kick)))
+        return -EFAULT;
+
+    if(kick.len == 0 || kick.offset >= GARAGE_MAP_SIZE || kick.len > GARAGE_MAP_SIZE - kick.offset)
+        return -EINVAL;
+
+    // only the client's own buffer, it has to be mapped first
+    if(READ_ONCE(c->map) == NULL)
+        return -EINVAL;
+
+    job = job_alloc(c, 0);
+    if(IS_ERR(job))
+        return PTR_ERR(job);
+
+    job->submit_ns = submit_ns;
+    job->map = c->map;
+    refcount_inc(&job->map->ref);
+    job->data = job->map->buf + kick.offset;
+    job->len = kick.len;
+
+    if((err = queue_submit(c->g, job, nonblock)) < 0)
+        job_free(job);
+
+    return err;
+}
+
+static long queue_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct garage_client *c = file->private_data;
+    int nonblock = file->f_flags & O_NONBLOCK;
+
+    switch(cmd) {
+        case GARAGE_IOC_SUBMIT_AT:
+            return queue_submit_at(c, (void __user *)arg, nonblock);
+        case GARAGE_IOC_KICK:
+            return queue_kick(c, (void __user *)arg, nonblock);
+        default:
+            return -ENOTTY;
+    }
+}
+
+// the client's sequence buffer, see GARAGE_IOC_KICK. Allocated on the
+// first mmap(), every later one maps the same buffer.
+static int queue_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct garage_client *c = file->private_data;
+    struct garage_map *map = READ_ONCE(c->map);
+
+    if(map == NULL) {
+        map = kmalloc(sizeof(*map), GFP_KERNEL);
+        if(map == NULL)
+            return -ENOMEM;
+
+        // sequences are parsed from it, so it is plain cached memory
+        map->buf = vmalloc_user(GARAGE_MAP_SIZE);
+        if(map->buf == NULL) {
+            kfree(map);
+            return -ENOMEM;
+        }
+        refcount_set(&map->ref, 1);
+
+        // another thread of the client may have been first
+        if(cmpxchg(&c->map, NULL, map) != NULL) {
+            map_put(map);
+            map = c->map;
+        }
+    }
+
+    return remap_vmalloc_range(vma, map->buf, vma->vm_pgoff);
+}
+
+static ssize_t queue_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos)
+{
+    struct garage_client *c = file->private_data;
+    struct garage_result res;
+    struct garage_job *job;
+    unsigned long flags;
+    size_t n = 0;
+
+    if(count < sizeof(res))
+        return -EINVAL;
+
+    if(!(file->f_flags & O_NONBLOCK)) {
+        if(wait_event_interruptible(c->wq, client_has_done(c)))
+            return -ERESTARTSYS;
+    }
+
+    while(n + sizeof(res) <= count) {
+        spin_lock_irqsave(&c->g->queue_lock, flags);
+        job = list_first_entry_or_null(&c->done, struct garage_job, list);
+        if(job)
+            list_del(&job->list);
+        spin_unlock_irqrestore(&c->g->queue_lock, flags);
+
+        if(job == NULL)
+            break;
+
+        stats_record(c->g, STAGE_WAKE, garage_now(c->g) - job->done_ns);
+
+        res.id = job->id;
+        res.status = job->status;
+        res.duration_ns = job->duration_ns;
+        res.start_error_ns = job->start_error_ns;
+        job_free(job);
+
+        if(copy_to_user(ubuf + n, &res, sizeof(res)))
+            return -EFAULT;
+
+        n += sizeof(res);
+    }
+
+    return n ? n : -EAGAIN;
+}
+
+static unsigned int queue_poll(struct file *file, poll_table *wait)
+{
+    struct garage_client *c = file->private_data;
+    unsigned int mask = 0;
+
+    poll_wait(file, &c->wq, wait);
+    poll_wait(file, &c->g->queue_wq, wait);
+
+    if(client_has_done(c))
+        mask |= POLLIN | POLLRDNORM;
+
+    if(READ_ONCE(c->g->queue_len) < QUEUE_MAX_JOBS)
+        mask |= POLLOUT | POLLWRNORM;
+
+    return mask;
+}
+
+static const struct file_operations queue_fops = {
+    .owner      = THIS_MODULE,
+    .open       = queue_open,
+    .release    = queue_release,
+    .write      = queue_write,
+    .read       = queue_read,
+    .poll       = queue_poll,
+    .mmap       = queue_mmap,
+    .unlocked_ioctl = queue_ioctl,
+    .compat_ioctl   = compat_ptr_ioctl,
+    .llseek     = no_llseek,
+};
+
+int queue_register(struct garage_dev *g)
+{
+    int err;
+
+    spin_lock_init(&g->queue_lock);
+    INIT_LIST_HEAD(&g->queue);
+    init_waitqueue_head(&g->queue_wq);
+    g->queue_len = 0;
+    g->job = NULL;
+    INIT_WORK(&g->queue_work, queue_work_fn);
+
+    g->queue_dev.minor = MISC_DYNAMIC_MINOR;
+    g->queue_dev.name = QUEUE_DEVNAME;
+    g->queue_dev.fops = &queue_fops;
+    g->queue_dev.parent = g->dev;
+
+    if((err = misc_register(&g->queue_dev)) < 0) {
+        dev_err(g->dev, "error: failed to register %s device\n", QUEUE_DEVNAME);
+        return err;
+    }
+
+    return 0;
+}
+
+void queue_unregister(struct garage_dev *g)
+{
+    struct garage_job *job, *tmp;
+
+    misc_deregister(&g->queue_dev);
+    cancel_work_sync(&g->queue_work);
+
+    list_for_each_entry_safe(job, tmp, &g->queue, list)
+        job_free(job);
+
+    INIT_LIST_HEAD(&g->queue);
+    g->queue_len = 0;
+}
@@ -0,0 +1,55 @@
+
+#ifndef __GARAGE_QUEUE_H__
+#define __GARAGE_QUEUE_H__
+
+#define QUEUE_DEVNAME       "garage-door"
+
+// maximum number of jobs waiting for transmission
+#define QUEUE_MAX_JOBS      64
+
+// maximum size of a single submitted sequence
+#define QUEUE_MAX_SEQ       (16*PAGE_SIZE)
+
+struct garage_dev;
+
+// a client's mmap()ed sequence buffer. Jobs queued from it hold a
+// reference, so it outlives a client closing with jobs still queued.
+struct garage_map {
+    refcount_t ref;
+    u8 *buf;                    // GARAGE_MAP_SIZE bytes
+};
+
+struct garage_client {
+    struct garage_dev *g;
+    struct list_head done;      // completed jobs, not read yet
+    wait_queue_head_t wq;
+    u32 next_id;
+    struct garage_map *map;     // allocated on the first mmap(), NULL before
+};
+
+struct garage_job {
+    struct list_head list;
+    struct garage_client *owner;    // NULL once the owner has gone away
+    struct garage_preset *preset;   // preset on air
+    u32 id;
+    struct garage_params params;
+    int status;
+    s64 duration_ns;
+    u64 submit_ns;                  // write() entry
+    u64 done_ns;                    // completion
+    u64 at_ns;                      // scheduled DMA start, 0 for none
+    s64 start_error_ns;             // actual minus scheduled DMA start
+    const u8 *data;                 // the sequence: seq, or in the mapped buffer
+    struct garage_map *map;         // the mapped buffer 'data' is in, or NULL
+    size_t len;
+    u8 seq[];
+};
+
+int queue_register(struct garage_dev *g);
+void queue_unregister(struct garage_dev *g);
+void queue_run(struct garage_dev *g);
+void queue_complete(struct garage_dev *g, int status);
+void queue_stop(struct garage_dev *g);
+int queue_send(struct garage_dev *g, const char *buf, size_t count);
+
+#endif
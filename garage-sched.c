@@ -0,0 +1,77 @@
+#include <linux/kernel.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <asm/processor.h>
+
+#include "garage-driver.h"
+#include "garage-queue.h"
+#include "garage-sched.h"
+
+// Scheduled start.
+//
+// A job with a start time is set up as soon as the transmitter gets to it:
+// carrier clock, PWM, DMA channel and CBs, with the carrier off. A hrtimer
+// fires SCHED_SPIN_NS before the start time, its callback spins the rest
+// and starts the DMA, so the start does not depend on submission, parsing
+// and building latencies. The callback runs in hard interrupt context, so
+// it spins SCHED_SPIN_NS at most and does not probe for the first DREQ. The difference between the actual and requested
+// DMA start is reported with the job result.
+
+static enum hrtimer_restart sched_expire(struct hrtimer *timer)
+{
+    struct garage_dev *g = container_of(timer, struct garage_dev, sched_timer);
+    s64 err;
+
+    while(garage_now(g) < g->sched_ns)
+        cpu_relax();
+
+    garage_watch(g, g->sched_prog);
+    garage_fire(g, g->sched_prog);
+
+    // the histograms are unsigned, early starts go in their own
+    err = g->start_ns - g->sched_ns;
+    if(err < 0)
+        stats_record(g, STAGE_EARLY, -err);
+    else
+        stats_record(g, STAGE_SCHED, err);
+
+    // the job is not completed before the program ends
+    if(g->job)
+        g->job->start_error_ns = err;
+
+    return HRTIMER_NORESTART;
+}
+
+void sched_init(struct garage_dev *g)
+{
+    hrtimer_init(&g->sched_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    g->sched_timer.function = sched_expire;
+}
+
+// start prepared program 'p' at 'at_ns' (CLOCK_MONOTONIC), -ETIME if it is
+// too late for that already
+int sched_arm(struct garage_dev *g, struct garage_prog *p, u64 at_ns)
+{
+    if(at_ns < garage_now(g) + SCHED_SPIN_NS)
+        return -ETIME;
+
+    g->sched_prog = p;
+    g->sched_ns = at_ns;
+    g->trigger_ns = 0; // submission to start is up to the client
+
+    hrtimer_start(&g->sched_timer, ns_to_ktime(at_ns - SCHED_SPIN_NS), HRTIMER_MODE_ABS);
+
+    return 0;
+}
+
+void sched_cancel(struct garage_dev *g)
+{
+    hrtimer_cancel(&g->sched_timer);
+}
+
+// take back a start that has not fired yet, true if it was. Does not wait
+// for a running callback, so it may be called under g->queue_lock.
+int sched_disarm(struct garage_dev *g)
+{
+    return hrtimer_try_to_cancel(&g->sched_timer) == 1;
+}
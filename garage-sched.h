@@ -0,0 +1,21 @@
+
+#ifndef __GARAGE_SCHED_H__
+#define __GARAGE_SCHED_H__
+
+// the timer fires this much ahead of the start time, the rest is spun.
+// Along with garage_fire() (register writes only, no DREQ probe) this is
+// all the time the hard interrupt takes.
+#define SCHED_SPIN_NS       10000
+
+// start times further ahead are rejected, the transmitter is held meanwhile
+#define SCHED_MAX_AHEAD_NS  (60ULL*NSEC_PER_SEC)
+
+struct garage_dev;
+struct garage_prog;
+
+void sched_init(struct garage_dev *g);
+int sched_arm(struct garage_dev *g, struct garage_prog *p, u64 at_ns);
+void sched_cancel(struct garage_dev *g);
+int sched_disarm(struct garage_dev *g);
+
+#endif
@@ -0,0 +1,516 @@
+
+#include "garage-driver.h"
+#include "garage-dma.h"
+#include "garage-gpio.h"
+#include "garage-pwm.h"
+#include "garage-clk.h"
+#include "garage-seq.h"
+#include "garage-uapi.h"
+#include "garage-enc.h"
+#include "garage-verify.h"
+
+void builder_init(struct garage_builder *b, struct garage_dev *g, struct garage_prog *p)
+{
+    b->g = g;
+    b->p = p;
+    b->levels = 2;
+    b->mod = MOD_ASK;
+    b->engine = ENGINE_PACED;
+    b->width = 0;
+    b->words = 0;
+    b->origin = 0;
+    b->carrier2 = 0;
+    b->ops = 0;
+    b->level = 0;
+    b->len = 0;
+    b->period_ps = 0;
+    b->ticks = 0;
+    b->exact_ps = 0;
+    b->build_ns = 0;
+
+    if(p)
+        prog_reset(p);
+}
+
+// ENGINE_FIFO: a run of FIFO words up to the current sample. The rounding
+// is done on the run end, so errors do not add up.
+static int builder_fifo_run(struct garage_builder *b, int level)
+{
+    u64 end = div_u64((b->ticks - b->origin)*b->width + 16, 32);
+    u32 words = end - b->words;
+
+    b->words = end;
+
+    if(SPAN_IS_TONE(level)) {
+        if(add_imm(b->g, b->p, PHYS_TO_DMA(CLK_BASE + PWMCLK_DIV), b->tones[level - SPAN_TONE(0)]) == NULL)
+            return b->p->add_err;
+        level = AMP_STEPS;
+    }
+
+    return add_fifo_run(b->g, b->p, level, words);
+}
+
+// flush a run into the program
+static int builder_run(struct garage_builder *b, int level, u32 len)
+{
+    u64 t0 = garage_now(b->g);
+    int err;
+
+    if(b->engine == ENGINE_FIFO)
+        err = builder_fifo_run(b, level);
+    else if(SPAN_IS_TONE(level))
+        err = add_tone_run(b->g, b->p, b->tones[level - SPAN_TONE(0)], len);
+    else if(b->carrier2 && len > 0 && add_fsel(b->g, b->p, level > 0) == NULL)
+        err = b->p->add_err;
+    else
+        err = add_run(b->g, b->p, level, len);
+    b->build_ns += garage_now(b->g) - t0;
+
+    return err;
+}
+
+static int builder_push(struct garage_builder *b, int sym, u32 len)
+{
+    int err, level;
+
+    if(sym < 0 || sym >= b->levels)
+        return -EINVAL;
+
+    if(len == 0)
+        return 0;
+
+    if(b->mod == MOD_FSK)
+        level = SPAN_TONE(sym);
+    else // nearest step of the amplitude table
+        level = (2*sym*AMP_STEPS + b->levels - 1)/(2*(b->levels - 1));
+
+    if((level != b->level || b->len > U32_MAX - len) && b->len > 0) {
+        if((err = builder_run(b, b->level, b->len)) < 0)
+            return err;
+        b->len = 0;
+    }
+
+    b->level = level;
+    b->len += len;
+    b->ticks += len;
+
+    return 0;
+}
+
+// emit 'len' symbols of value 'sym' (0..levels-1, 0 is carrier off and
+// levels-1 full amplitude, or the tone index with FSK)
+int builder_emit(struct garage_builder *b, int sym, int len)
+{
+    if(len <= 0)
+        return 0;
+
+    b->exact_ps += len*b->period_ps;
+
+    return builder_push(b, sym, len);
+}
+
+// emit 'sym' for 'ns' nanoseconds, rounded to whole sample periods. The
+// rounding is done on the segment end, so errors do not add up.
+int builder_segment(struct garage_builder *b, int sym, u32 ns)
+{
+    u64 end;
+
+    if(b->period_ps == 0)
+        return -EINVAL;
+
+    b->exact_ps += (u64)ns*1000;
+    end = div64_u64(b->exact_ps + b->period_ps/2, b->period_ps);
+
+    return builder_push(b, sym, end > b->ticks ? end - b->ticks : 0);
+}
+
+static int builder_flush(struct garage_builder *b)
+{
+    int err;
+
+    if(b->len == 0)
+        return 0;
+
+    if((err = builder_run(b, b->level, b->len)) < 0)
+        return err;
+    b->len = 0;
+
+    return 0;
+}
+
+// flush the pending run, turn the busy led off and raise the final interrupt
+int builder_finish(struct garage_builder *b)
+{
+    struct bcm2708_dma_cb *cb;
+    int err;
+
+    if((err = builder_flush(b)) < 0)
+        return err;
+
+    // second carrier off, whatever the frame ends with
+    if(b->carrier2 && add_fsel(b->g, b->p, 0) == NULL)
+        return b->p->add_err;
+
+    // PWM_STAT while the last run is still in the FIFO
+    if(add_stat(b->g, b->p) == NULL)
+        return b->p->add_err;
+
+    if(b->engine == ENGINE_FIFO && (err = add_fifo_run(b->g, b->p, 0, FIFO_TAIL_WORDS)) < 0)
+        return err;
+
+    cb = add_xfer(b->g, b->p, b->g->buf_handle+4*BUF_LED, PHYS_TO_DMA(GPIO_BASE + GPIO_REG_CLEAR(BUSY_LED_PIN)), 4);
+    if(cb == NULL)
+        return b->p->add_err;
+
+    cb->info |= BCM2708_DMA_INT_EN;
+
+    return 0;
+}
+
+// one digit per symbol ('0' and '1', up to '7' with 8 levels),
+// anything else is ignored
+static int compile_ascii(struct garage_builder *b, const u8 *buf, size_t len)
+{
+    size_t i;
+    int err;
+
+    for(i=0;i<len && buf[i];i++) {
+        if(buf[i] < '0' || buf[i] >= '0' + b->levels)
+            continue; // ignore
+
+        if((err = builder_emit(b, buf[i] - '0', 1)) < 0)
+            return err;
+    }
+
+    return 0;
+}
+
+// 'n' bits starting at bit 'off', MSB first
+static int bits_get(const u8 *buf, size_t off, int n)
+{
+    int v = 0;
+
+    for(;n>0;n--,off++)
+        v = v << 1 | ((buf[off/8] >> (7 - off%8)) & 1);
+
+    return v;
+}
+
+// parse binary ops up to GS_OP_END or the end of buffer
+static int compile_block(struct garage_builder *b, const u8 *buf, size_t len, size_t *pos, int depth)
+{
+    size_t start, i, n, nbits;
+    int err, count, bps = ilog2(b->levels);
+    u32 run;
+    u8 op;
+
+    while(*pos < len) {
+        op = buf[(*pos)++];
+
+        if(++b->ops > SEQ_MAX_OPS)
+            return -E2BIG;
+
+        switch(op) {
+            case GS_OP_BITS:
+                if(*pos + 2 > len)
+                    return -EINVAL;
+                n = get_unaligned_le16(buf + *pos);
+                nbits = n*bps;
+                *pos += 2;
+
+                if(*pos + DIV_ROUND_UP(nbits, 8) > len)
+                    return -EINVAL;
+
+                if((b->ops += n) > SEQ_MAX_OPS)
+                    return -E2BIG;
+
+                for(i=0;i<n;i++) {
+                    if((err = builder_emit(b, bits_get(buf + *pos, i*bps, bps), 1)) < 0)
+                        return err;
+                }
+                *pos += DIV_ROUND_UP(nbits, 8);
+                break;
+
+            case GS_OP_RUN:
+                if(*pos + 5 > len || buf[*pos] >= b->levels)
+                    return -EINVAL;
+
+                // builder_emit() takes an int
+                if((run = get_unaligned_le32(buf + *pos + 1)) > INT_MAX)
+                    return -EINVAL;
+
+                if((err = builder_emit(b, buf[*pos], run)) < 0)
+                    return err;
+                *pos += 5;
+                break;
+
+            case GS_OP_SEGMENT:
+                if(*pos + 5 > len || buf[*pos] >= b->levels)
+                    return -EINVAL;
+
+                if((err = builder_segment(b, buf[*pos], get_unaligned_le32(buf + *pos + 1))) < 0)
+                    return err;
+                *pos += 5;
+                break;
+
+            case GS_OP_REPEAT:
+                if(*pos + 2 > len || depth >= SEQ_MAX_DEPTH)
+                    return -EINVAL;
+                count = get_unaligned_le16(buf + *pos);
+                *pos += 2;
+
+                if(count == 0)
+                    return -EINVAL;
+
+                // every round counts, so empty bodies are bounded too
+                start = *pos;
+                do {
+                    *pos = start;
+                    if(++b->ops > SEQ_MAX_OPS)
+                        return -E2BIG;
+                    if((err = compile_block(b, buf, len, pos, depth + 1)) < 0)
+                        return err;
+                } while(--count > 0);
+                break;
+
+            case GS_OP_END:
+                return depth > 0 ? 0 : -EINVAL;
+
+            default:
+                return -EINVAL;
+        }
+    }
+
+    return depth > 0 ? -EINVAL : 0;
+}
+
+// one frame: a code (when a line encoder is selected), an ASCII or a
+// binary sequence
+static int compile_frame(struct garage_builder *b, const struct garage_params *params, const u8 *buf, size_t len)
+{
+    size_t pos = GS_HDR_LEN;
+    int err;
+
+    if(params->enc) {
+        err = encoder_compile(b, params->enc, PROTO_FRAME, buf, len);
+        if(err == -EINVAL)
+            dev_err(b->g->dev, "error: invalid code for %s encoding\n", params->enc->name);
+    } else if(len >= GS_HDR_LEN && buf[0] == GS_MAGIC0 && buf[1] == GS_MAGIC1) {
+        if(buf[2] != GS_VERSION) {
+            dev_err(b->g->dev, "error: unsupported binary sequence version %d\n", buf[2]);
+            return -EINVAL;
+        }
+
+        b->ops = 0;
+        err = compile_block(b, buf, len, &pos, 0);
+        if(err == -EINVAL)
+            dev_err(b->g->dev, "error: malformed binary sequence at offset %zu\n", pos);
+        else if(err == -E2BIG)
+            dev_err(b->g->dev, "error: binary sequence expands to more than %d ops\n", SEQ_MAX_OPS);
+    } else {
+        err = compile_ascii(b, buf, len);
+    }
+
+    return err;
+}
+
+// the line encoder's preamble or postamble around the frames, if any
+static int compile_framing(struct garage_builder *b, const struct garage_params *params, int part)
+{
+    if(params->enc == NULL)
+        return 0;
+
+    return encoder_compile(b, params->enc, part, NULL, 0);
+}
+
+// Carrier sweep: the frame is built once, preceded by a pair of CBs per
+// sweep step. The first one sets PWMCLK_DIV, the second one relinks the
+// last CB of the frame to the next pair, or to the final CB after the
+// last step, and both continue into the frame. The DMA patches the
+// program as it goes, the CPU does not touch it. Each step is a whole
+// transmission, with the line encoder's preamble and postamble, after
+// PACED_LEAD_WORDS samples of carrier off: the divider is written while
+// that many words are still queued, so those go out at the new step's
+// frequency (and they are not the previous step's frame).
+static int compile_sweep(struct garage_builder *b, const struct garage_params *params,
+        const u32 *divs, int n, const u8 *buf, size_t len)
+{
+    struct garage_prog *p = b->p;
+    struct bcm2708_dma_cb *cb;
+    int i, err, first = p->sample, frame, tail;
+
+    for(i=0;i<n;i++) {
+        if(add_imm(b->g, p, PHYS_TO_DMA(CLK_BASE + PWMCLK_DIV), divs[i]) == NULL ||
+                add_imm(b->g, p, 0, 0) == NULL)
+            return b->p->add_err;
+    }
+
+    frame = p->sample;
+    if((err = builder_emit(b, 0, PACED_LEAD_WORDS)) < 0 ||
+            (err = compile_framing(b, params, PROTO_PREAMBLE)) < 0 ||
+            (err = compile_frame(b, params, buf, len)) < 0 ||
+            (err = compile_framing(b, params, PROTO_POSTAMBLE)) < 0 ||
+            (err = builder_flush(b)) < 0)
+        return err;
+
+    if(p->sample == frame)
+        return -EINVAL; // nothing to repeat
+    tail = p->sample - 1;
+
+    if((err = builder_finish(b)) < 0)
+        return err;
+    b->ticks *= n; // on air n times
+
+    for(i=0;i<n;i++) {
+        cb = prog_cb(p, first + 2*i+1);
+        cb->dst = prog_cb_addr(p, tail) + offsetof(struct bcm2708_dma_cb, next);
+        cb->pad[0] = prog_cb_addr(p, i < n-1 ? first + 2*i+2 : tail+1);
+        cb->next = prog_cb_addr(p, frame);
+    }
+
+    return 0;
+}
+
+// Repeated frame: the frame is built once and followed by a CB raising
+// an interrupt and linking back to its start. The driver counts the
+// frames and opens the loop on the last one (garage_repeat_done()), the
+// program then goes on with a CB setting BUF_DONE and the final one.
+// A line encoder's preamble and postamble are outside of the loop.
+static int compile_repeat(struct garage_builder *b, const struct garage_params *params, const u8 *buf, size_t len)
+{
+    struct garage_prog *p = b->p;
+    struct bcm2708_dma_cb *cb;
+    int err, frame;
+
+    if((err = compile_framing(b, params, PROTO_PREAMBLE)) < 0 || (err = builder_flush(b)) < 0)
+        return err;
+
+    // every round of the frame is the same FIFO words
+    b->origin = b->ticks;
+    b->words = 0;
+
+    frame = p->sample;
+    if((err = compile_frame(b, params, buf, len)) < 0 || (err = builder_flush(b)) < 0)
+        return err;
+
+    if(p->sample == frame)
+        return -EINVAL; // nothing to repeat
+
+    if((cb = add_imm(b->g, p, b->g->buf_handle+4*BUF_DONE, 0)) == NULL)
+        return b->p->add_err;
+    cb->info |= BCM2708_DMA_INT_EN;
+    p->loop = p->sample - 1;
+
+    if(add_imm(b->g, p, b->g->buf_handle+4*BUF_DONE, 1) == NULL)
+        return b->p->add_err;
+
+    if((err = compile_framing(b, params, PROTO_POSTAMBLE)) < 0 || (err = builder_finish(b)) < 0)
+        return err;
+
+    p->loop_next = prog_cb_addr(p, frame);
+    prog_cb(p, p->loop)->next = p->loop_next;
+
+    return 0;
+}
+
+static int compile_into(struct garage_builder *b, const struct garage_params *params, const u8 *buf, size_t len)
+{
+    u32 clk_ctl, clk_div, clk2_ctl, clk2_div, divs[SWEEP_MAX];
+    int err, n;
+
+    // segment durations are converted with the actual sample period
+    if((err = pwm_clock_calc(params->freq*2, &clk_ctl, &clk_div)) < 0)
+        return err;
+    b->period_ps = timeline_period_ps(params, clk_div);
+    b->engine = params->engine;
+    b->width = 2*params->freq/params->srate;
+
+    // ENGINE_PACED: every amplitude write lands PACED_LEAD_WORDS samples
+    // ahead of the FIFO words it is paced by, so the first run would lose
+    // that many. Carrier off samples in front of it take the loss.
+    if(b->engine == ENGINE_PACED && (err = add_wait(b->g, b->p, PACED_LEAD_WORDS)) < 0)
+        return err;
+
+    if(params->mod == MOD_FSK) {
+        // one tone per symbol, the carrier stays at full amplitude
+        if((err = pwm_tone_calc(params, b->tones)) < 0) {
+            dev_err(b->g->dev, "error: invalid FSK tones\n");
+            return err;
+        }
+        b->levels = err;
+        b->mod = MOD_FSK;
+
+        if(b->engine == ENGINE_PACED &&
+                add_xfer(b->g, b->p, b->g->buf_handle+4*BUF_AMP(AMP_STEPS), PHYS_TO_DMA(PWM_BASE + PWM_DAT1), 4) == NULL)
+            return b->p->add_err;
+    } else if(params->levels) {
+        if(params->levels != 2 && params->levels != 4 && params->levels != 8)
+            return -EINVAL;
+        b->levels = params->levels;
+    }
+
+    if(params->carrier2) {
+        // keyed on/off in step with the PWM1 amplitude writes, which only
+        // the paced engine has
+        if(params->mod == MOD_FSK || params->engine != ENGINE_PACED ||
+                gpclk_calc(params->carrier2, &clk2_ctl, &clk2_div) < 0) {
+            dev_err(b->g->dev, "error: invalid second carrier\n");
+            return -EINVAL;
+        }
+        b->carrier2 = 1;
+    }
+
+    if(params->sweep_step) {
+        // the tones already own the clock divider, and a sweep loops by itself
+        if(params->mod == MOD_FSK || params_repeating(params) || (n = pwm_sweep_calc(params, divs)) < 0) {
+            dev_err(b->g->dev, "error: invalid carrier sweep\n");
+            return -EINVAL;
+        }
+
+        return compile_sweep(b, params, divs, n, buf, len);
+    }
+
+    if(params_repeating(params))
+        return compile_repeat(b, params, buf, len);
+
+    if((err = compile_framing(b, params, PROTO_PREAMBLE)) < 0 ||
+            (err = compile_frame(b, params, buf, len)) < 0 ||
+            (err = compile_framing(b, params, PROTO_POSTAMBLE)) < 0)
+        return err;
+
+    return builder_finish(b);
+}
+
+static int compile_program(struct garage_dev *g, struct garage_prog *p, const struct garage_params *params, const u8 *buf, size_t len, int record)
+{
+    struct garage_builder b;
+    u64 t0 = garage_now(g);
+    int err;
+
+    builder_init(&b, g, p);
+
+    err = compile_into(&b, params, buf, len);
+
+    if(err == 0) {
+        p->air_ns = div_u64(b.ticks*b.period_ps, 1000);
+        if(record) {
+            stats_record(g, STAGE_PARSE, garage_now(g) - t0 - b.build_ns);
+            stats_record(g, STAGE_BUILD, b.build_ns);
+        }
+    }
+
+    return err;
+}
+
+// compile a code (when a line encoder is selected), an ASCII or a binary
+// sequence into a DMA program
+int compile_sequence(struct garage_dev *g, struct garage_prog *p, const struct garage_params *params, const u8 *buf, size_t len)
+{
+    return compile_program(g, p, params, buf, len, 1);
+}
+
+// same, for a program that is not transmitted: the latency stats are left alone
+int compile_check(struct garage_dev *g, struct garage_prog *p, const struct garage_params *params, const u8 *buf, size_t len)
+{
+    return compile_program(g, p, params, buf, len, 0);
+}
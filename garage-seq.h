@@ -0,0 +1,47 @@
+
+#ifndef __GARAGE_SEQ_H__
+#define __GARAGE_SEQ_H__
+
+// maximum nesting of GS_OP_REPEAT blocks
+#define SEQ_MAX_DEPTH   4
+
+// most binary ops and symbols a frame may expand to, nested repeats could
+// otherwise ask for 65535^4 of them
+#define SEQ_MAX_OPS     (1 << 20)
+
+struct garage_dev;
+struct garage_prog;
+struct garage_params;
+
+// run-length CB builder: consecutive runs of the same level are merged
+// into a single amplitude write and FIFO wait (or a single run of FIFO
+// words with ENGINE_FIFO)
+struct garage_builder {
+    struct garage_dev *g;
+    struct garage_prog *p;
+    int levels;         // symbol alphabet, 2, 4 or 8 amplitude levels (or tones)
+    int mod;            // MOD_ASK or MOD_FSK
+    int engine;         // ENGINE_PACED or ENGINE_FIFO
+    u32 width;          // ENGINE_FIFO: PWM clocks per sample period
+    u64 words;          // ENGINE_FIFO: FIFO words emitted since 'origin'
+    u64 origin;         // ENGINE_FIFO: start of the repeated frame, in sample periods
+    int carrier2;       // key the second carrier along with every run
+    u32 ops;            // binary ops and symbols expanded in this frame
+    u32 tones[TONES_MAX];   // FSK: PWMCLK_DIV word of each tone
+    int level;          // amplitude of the pending run, 0..AMP_STEPS, or SPAN_TONE()
+    u32 len;            // length of the pending run, in sample periods
+    u64 period_ps;      // sample period
+    u64 ticks;          // sample periods emitted so far
+    u64 exact_ps;       // where they should end, segments are rounded against it
+    u64 build_ns;       // time spent adding CBs
+};
+
+void builder_init(struct garage_builder *b, struct garage_dev *g, struct garage_prog *p);
+int builder_emit(struct garage_builder *b, int sym, int len);
+int builder_segment(struct garage_builder *b, int sym, u32 ns);
+int builder_finish(struct garage_builder *b);
+
+int compile_sequence(struct garage_dev *g, struct garage_prog *p, const struct garage_params *params, const u8 *buf, size_t len);
+int compile_check(struct garage_dev *g, struct garage_prog *p, const struct garage_params *params, const u8 *buf, size_t len);
+
+#endif
@@ -0,0 +1,104 @@
+
+#include "garage-driver.h"
+#include "garage-stats.h"
+
+#ifdef __KERNEL__
+#define CREATE_TRACE_POINTS
+#include "garage-trace.h"
+#endif
+
+// Latency histograms of the transmit path stages, see garage-stats.h.
+// Every sample is also emitted as a garage:garage_stage tracepoint.
+
+static const struct {
+    int stage;
+    const char *name;
+} stages[] = {
+    GARAGE_STAGES
+};
+
+void stats_init(struct garage_dev *g)
+{
+    spin_lock_init(&g->stats.lock);
+    stats_reset(g);
+}
+
+void stats_reset(struct garage_dev *g)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&g->stats.lock, flags);
+    memset(g->stats.hist, 0, sizeof(g->stats.hist));
+    spin_unlock_irqrestore(&g->stats.lock, flags);
+}
+
+void stats_record(struct garage_dev *g, int stage, u64 ns)
+{
+    struct garage_hist *h = &g->stats.hist[stage];
+    unsigned long flags;
+    int bucket = fls64(ns);
+
+#ifdef __KERNEL__
+    trace_garage_stage(stage, ns);
+#endif
+
+    if(bucket >= STATS_BUCKETS)
+        bucket = STATS_BUCKETS - 1;
+
+    spin_lock_irqsave(&g->stats.lock, flags);
+
+    if(h->count == 0 || ns < h->min)
+        h->min = ns;
+    if(ns > h->max)
+        h->max = ns;
+    h->count++;
+    h->sum += ns;
+    h->buckets[bucket]++;
+
+    spin_unlock_irqrestore(&g->stats.lock, flags);
+}
+
+// upper bound of the bucket holding the 99th percentile
+static u64 hist_p99(const struct garage_hist *h)
+{
+    u64 seen = 0, want = h->count - div_u64(h->count, 100);
+    int i;
+
+    for(i=0;i<STATS_BUCKETS;i++) {
+        seen += h->buckets[i];
+        if(seen >= want)
+            break;
+    }
+
+    if(i >= 63 || (1ULL << i) > h->max)
+        return h->max;
+
+    return 1ULL << i;
+}
+
+int stats_print(struct garage_dev *g, char *buf, size_t size)
+{
+    struct garage_hist h;
+    unsigned long flags;
+    int i, n = 0;
+
+    n += scnprintf(buf + n, size - n, "%-8s %10s %12s %12s %12s %12s\n", "stage", "count", "min ns", "avg ns", "p99 ns", "max ns");
+
+    for(i=0;i<ARRAY_SIZE(stages);i++) {
+        spin_lock_irqsave(&g->stats.lock, flags);
+        h = g->stats.hist[stages[i].stage];
+        spin_unlock_irqrestore(&g->stats.lock, flags);
+
+        if(h.count == 0) {
+            n += scnprintf(buf + n, size - n, "%-8s %10d\n", stages[i].name, 0);
+            continue;
+        }
+
+        n += scnprintf(buf + n, size - n, "%-8s %10llu %12llu %12llu %12llu %12llu\n", stages[i].name,
+                (unsigned long long)h.count, (unsigned long long)h.min,
+                (unsigned long long)div64_u64(h.sum, h.count),
+                (unsigned long long)hist_p99(&h), (unsigned long long)h.max);
+    }
+
+    return n;
+}
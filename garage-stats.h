@@ -0,0 +1,56 @@
+
+#ifndef __GARAGE_STATS_H__
+#define __GARAGE_STATS_H__
+
+// stages of the transmit path, each one gets a latency histogram
+#define STAGE_QUEUE     0   // submission -> job taken off the queue
+#define STAGE_PARSE     1   // sequence parsing (compile time minus CB building)
+#define STAGE_BUILD     2   // CB building
+#define STAGE_CLAIM     3   // DMA channel claim (callback hand-over)
+#define STAGE_CLOCK     4   // PWM clock and PWM setup
+#define STAGE_START     5   // channel reset and DMA start
+#define STAGE_DREQ      6   // DMA start -> first DREQ served
+#define STAGE_TRIGGER   7   // submission -> DMA start
+#define STAGE_AIR       8   // DMA start -> completion interrupt
+#define STAGE_WAKE      9   // completion interrupt -> waiter woken up
+#define STAGE_SCHED     10  // start time of a scheduled job -> DMA start
+#define STAGE_EARLY     11  // DMA start -> start time, scheduled starts ahead of time
+#define STAGE_COUNT     12
+
+#define GARAGE_STAGES \
+    { STAGE_QUEUE, "queue" }, \
+    { STAGE_PARSE, "parse" }, \
+    { STAGE_BUILD, "build" }, \
+    { STAGE_CLAIM, "claim" }, \
+    { STAGE_CLOCK, "clock" }, \
+    { STAGE_START, "start" }, \
+    { STAGE_DREQ, "dreq" }, \
+    { STAGE_TRIGGER, "trigger" }, \
+    { STAGE_AIR, "air" }, \
+    { STAGE_WAKE, "wake" }, \
+    { STAGE_SCHED, "sched" }, \
+    { STAGE_EARLY, "early" }
+
+// log2 buckets of nanoseconds, bucket i counts [2^(i-1), 2^i)
+#define STATS_BUCKETS   40
+
+struct garage_hist {
+    u64 count;
+    u64 sum;
+    u64 min, max;
+    u32 buckets[STATS_BUCKETS];
+};
+
+struct garage_stats {
+    spinlock_t lock;
+    struct garage_hist hist[STAGE_COUNT];
+};
+
+struct garage_dev;
+
+void stats_init(struct garage_dev *g);
+void stats_reset(struct garage_dev *g);
+void stats_record(struct garage_dev *g, int stage, u64 ns);
+int stats_print(struct garage_dev *g, char *buf, size_t size);
+
+#endif
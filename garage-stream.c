@@ -0,0 +1,313 @@
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/io.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/uaccess.h>
+#include <linux/timekeeping.h>
+
+#include "garage-driver.h"
+#include "garage-dma.h"
+#include "garage-gpio.h"
+#include "garage-stream.h"
+#include "garage-queue.h"
+
+// Streaming transmission.
+//
+// Symbols written to /dev/garage-stream are queued in a kfifo and
+// transmitted through a ring of STREAM_SLOTS runs. Each half of the ring
+// raises an interrupt when done, and the completion callback refills
+// the consumed half from the kfifo while DMA is busy with the other one.
+// When the writer closes the device, the end of stream is linked into the
+// ring and the transmission stops after the last queued symbol.
+//
+// CB layout:
+//  [0 .. 2*STREAM_SLOTS-1]  ring, two CBs per slot (amplitude, FIFO wait)
+//  [STREAM_END]             copy PWM_STAT (see garage-health.c)
+//  [STREAM_END+1]           set BUF_DONE
+//  [STREAM_END+2]           busy led off, raise the final interrupt
+
+#define STREAM_END (2*STREAM_SLOTS)
+
+static void stream_set_slot(struct garage_dev *g, int slot, int bit, int len)
+{
+    prog_cb(&g->prog, 2*slot)->src = g->buf_handle + 4*BUF_AMP(bit ? AMP_STEPS : 0);
+    prog_cb(&g->prog, 2*slot+1)->length = 4*len;
+}
+
+// take the next run of identical symbols from the fifo
+static int stream_next_run(struct garage_dev *g, int *bit)
+{
+    int len = 0;
+    u8 c;
+
+    while(kfifo_peek(&g->stream_fifo, &c)) {
+        if(c != '0' && c != '1') {
+            kfifo_skip(&g->stream_fifo); // ignore
+            continue;
+        }
+
+        if(len > 0 && (c == '1') != *bit)
+            break;
+
+        *bit = c == '1';
+        kfifo_skip(&g->stream_fifo);
+        len++;
+    }
+
+    return len;
+}
+
+static void stream_refill(struct garage_dev *g, int first, int count)
+{
+    int slot, bit = 0, len;
+
+    for(slot=first;slot<first+count && !g->stream_ending;slot++) {
+        len = stream_next_run(g, &bit);
+
+        if(len == 0) {
+            // underrun: keep the carrier off for one period
+            bit = 0;
+            len = 1;
+
+            if(g->stream_eof) {
+                prog_cb(&g->prog, 2*slot+1)->next = prog_cb_addr(&g->prog, STREAM_END);
+                g->stream_ending = 1;
+            }
+        }
+
+        stream_set_slot(g, slot, bit, len);
+    }
+
+    wmb();
+
+    wake_up_interruptible(&g->stream_wq);
+}
+
+// stop the stream and give the transmitter back, 'timeout' if the
+// watchdog ended it
+void stream_stop(struct garage_dev *g, int timeout)
+{
+    u64 diff = garage_now(g) - g->start_ns;
+
+    health_check(g, timeout);
+
+    garage_stop(g);
+
+    clear_bit(GARAGE_STREAMING, &g->flags);
+    clear_bit(GARAGE_BUSY, &g->flags);
+    wake_up(&g->wq);    // stream_release() waits uninterruptibly
+    wake_up_interruptible(&g->stream_wq);
+
+    printk(KERN_INFO "stream %s: %ld ms\n", timeout ? "timed out" : "done", (long)div_u64(diff, NSEC_PER_MSEC));
+
+    // run jobs queued while streaming
+    queue_run(g);
+}
+
+static void stream_irq(void *data)
+{
+    struct garage_dev *g = data;
+
+    if(g->buf[BUF_DONE]) {
+        // the watchdog gave up on the stream already
+        if(!test_and_clear_bit(GARAGE_WATCH, &g->flags))
+            return;
+        cancel_delayed_work(&g->watchdog_work);
+
+        stream_stop(g, 0);
+        return;
+    }
+
+    // the other half is on air now
+    garage_watch(g, &g->prog);
+
+    stream_refill(g, g->stream_half*STREAM_SLOTS/2, STREAM_SLOTS/2);
+    g->stream_half ^= 1;
+}
+
+static int stream_start(struct garage_dev *g)
+{
+    struct garage_params params;
+    struct bcm2708_dma_cb *cb;
+    int slot, err;
+
+    garage_params_get(g, &params);
+
+    // slots are rewritten in place as amplitude and wait CB pairs, there
+    // is no room for keying a second carrier
+    params.engine = ENGINE_PACED;
+    params.carrier2 = 0;
+    params.repeat = 0;  // the ring loops by itself
+
+    if(test_and_set_bit(GARAGE_BUSY, &g->flags))
+        return -EBUSY;
+
+    if((err = garage_set_tx(g, &params)) < 0) {
+        clear_bit(GARAGE_BUSY, &g->flags);
+        return err;
+    }
+
+    if((err = garage_prepare(g, stream_irq, 1)) < 0) {
+        clear_bit(GARAGE_BUSY, &g->flags);
+        return err;
+    }
+
+    // the last job may have left a repeated frame's loop behind
+    prog_reset(&g->prog);
+
+    for(slot=0;slot<STREAM_SLOTS;slot++) {
+        if((err = add_run(g, &g->prog, 0, 1)) < 0)
+            goto fail;
+
+        // interrupt at half-ring boundaries
+        if(slot == STREAM_SLOTS/2-1 || slot == STREAM_SLOTS-1)
+            prog_cb(&g->prog, g->prog.sample-1)->info |= BCM2708_DMA_INT_EN;
+    }
+
+    if(add_stat(g, &g->prog) == NULL) {
+        err = g->prog.add_err;
+        goto fail;
+    }
+
+    cb = add_xfer(g, &g->prog, g->buf_handle+4*BUF_LED, g->buf_handle+4*BUF_DONE, 4);
+    if(cb == NULL) {
+        err = g->prog.add_err;
+        goto fail;
+    }
+
+    cb = add_xfer(g, &g->prog, g->buf_handle+4*BUF_LED, PHYS_TO_DMA(GPIO_BASE + GPIO_REG_CLEAR(BUSY_LED_PIN)), 4);
+    if(cb == NULL) {
+        err = g->prog.add_err;
+        goto fail;
+    }
+    cb->info |= BCM2708_DMA_INT_EN;
+
+    // close the ring
+    prog_cb(&g->prog, STREAM_END-1)->next = prog_cb_addr(&g->prog, 0);
+
+    g->buf[BUF_DONE] = 0;
+    g->stream_half = 0;
+    g->stream_ending = 0;
+    stream_refill(g, 0, STREAM_SLOTS);
+
+    set_bit(GARAGE_STREAMING, &g->flags);
+
+    // the watchdog expects an interrupt per half ring, which holds at
+    // most the whole kfifo and a period per slot
+    g->prog.air_ns = div_u64((u64)(STREAM_FIFO_SIZE + STREAM_SLOTS)*NSEC_PER_SEC, params.srate);
+    garage_watch(g, &g->prog);
+    garage_fire(g, &g->prog);
+    garage_probe_dreq(g, &g->prog);
+
+    return 0;
+
+fail:
+    garage_stop(g);
+    clear_bit(GARAGE_BUSY, &g->flags);
+    return err;
+}
+
+static int stream_open(struct inode *inode, struct file *file)
+{
+    struct garage_dev *g = container_of(file->private_data, struct garage_dev, stream_dev);
+
+    if(test_and_set_bit(GARAGE_STREAM_OPEN, &g->flags))
+        return -EBUSY;
+
+    kfifo_reset(&g->stream_fifo);
+    g->stream_eof = 0;
+
+    return nonseekable_open(inode, file);
+}
+
+static ssize_t stream_write(struct file *file, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+    struct garage_dev *g = container_of(file->private_data, struct garage_dev, stream_dev);
+    unsigned int copied;
+    int err;
+
+    if(mutex_lock_interruptible(&g->stream_lock))
+        return -ERESTARTSYS;
+
+    if(!test_bit(GARAGE_STREAMING, &g->flags) && test_bit(GARAGE_BUSY, &g->flags)) {
+        mutex_unlock(&g->stream_lock);
+        return -EBUSY;
+    }
+
+    while(kfifo_is_full(&g->stream_fifo)) {
+        mutex_unlock(&g->stream_lock);
+
+        if(file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+
+        if(wait_event_interruptible(g->stream_wq, !kfifo_is_full(&g->stream_fifo)))
+            return -ERESTARTSYS;
+
+        if(mutex_lock_interruptible(&g->stream_lock))
+            return -ERESTARTSYS;
+    }
+
+    err = kfifo_from_user(&g->stream_fifo, ubuf, count, &copied);
+
+    // start airing as soon as the first symbols arrive
+    if(err == 0 && !test_bit(GARAGE_STREAMING, &g->flags))
+        err = stream_start(g);
+
+    mutex_unlock(&g->stream_lock);
+
+    return err < 0 ? err : copied;
+}
+
+static int stream_release(struct inode *inode, struct file *file)
+{
+    struct garage_dev *g = container_of(file->private_data, struct garage_dev, stream_dev);
+
+    mutex_lock(&g->stream_lock);
+
+    // drain the fifo, the completion callback links in the end of stream
+    g->stream_eof = 1;
+    wait_event(g->wq, !test_bit(GARAGE_STREAMING, &g->flags));
+
+    mutex_unlock(&g->stream_lock);
+
+    clear_bit(GARAGE_STREAM_OPEN, &g->flags);
+
+    return 0;
+}
+
+static const struct file_operations stream_fops = {
+    .owner      = THIS_MODULE,
+    .open       = stream_open,
+    .write      = stream_write,
+    .release    = stream_release,
+    .llseek     = no_llseek,
+};
+
+int stream_register(struct garage_dev *g)
+{
+    int err;
+
+    mutex_init(&g->stream_lock);
+    init_waitqueue_head(&g->stream_wq);
+    INIT_KFIFO(g->stream_fifo);
+
+    g->stream_dev.minor = MISC_DYNAMIC_MINOR;
+    g->stream_dev.name = STREAM_DEVNAME;
+    g->stream_dev.fops = &stream_fops;
+    g->stream_dev.parent = g->dev;
+
+    if((err = misc_register(&g->stream_dev)) < 0) {
+        dev_err(g->dev, "error: failed to register %s device\n", STREAM_DEVNAME);
+        return err;
+    }
+
+    return 0;
+}
+
+void stream_unregister(struct garage_dev *g)
+{
+    misc_deregister(&g->stream_dev);
+}
@@ -0,0 +1,16 @@
+
+#ifndef __GARAGE_STREAM_H__
+#define __GARAGE_STREAM_H__
+
+#define STREAM_DEVNAME "garage-stream"
+
+// number of runs in the CB ring (each run takes two CBs), must be even
+#define STREAM_SLOTS 64
+
+struct garage_dev;
+
+int stream_register(struct garage_dev *g);
+void stream_unregister(struct garage_dev *g);
+void stream_stop(struct garage_dev *g, int timeout);
+
+#endif
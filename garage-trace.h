@@ -0,0 +1,35 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM garage
+
+#if !defined(__GARAGE_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __GARAGE_TRACE_H__
+
+#include <linux/tracepoint.h>
+
+#include "garage-stats.h"
+
+// one event per transmit path stage, with its duration
+TRACE_EVENT(garage_stage,
+    TP_PROTO(int stage, u64 ns),
+    TP_ARGS(stage, ns),
+
+    TP_STRUCT__entry(
+        __field(int, stage)
+        __field(u64, ns)
+    ),
+
+    TP_fast_assign(
+        __entry->stage = stage;
+        __entry->ns = ns;
+    ),
+
+    TP_printk("%s %llu ns", __print_symbolic(__entry->stage, GARAGE_STAGES), (unsigned long long)__entry->ns)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE garage-trace
+#include <trace/define_trace.h>
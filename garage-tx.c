@@ -0,0 +1,214 @@
+
+#include "garage-driver.h"
+#include "garage-dma.h"
+#include "garage-gpio.h"
+#include "garage-pwm.h"
+#include "garage-clk.h"
+
+// Transmission control, shared by the kernel module and the simulator.
+
+// stop GPCLK0 and leave CARRIER2_PIN an input, if the second carrier was
+// used at all
+static void garage_carrier2_stop(struct garage_dev *g)
+{
+    if(!test_and_clear_bit(GARAGE_CARRIER2, &g->flags))
+        return;
+
+    gpio_set_mode(g, CARRIER2_PIN, GPIO_MODE_IN);
+    gpclk_stop(g);
+}
+
+void garage_stop(struct garage_dev *g)
+{
+    g->air = NULL;
+    clear_bit(GARAGE_WARM, &g->flags);
+    gpio_set_mode(g, 18, 1);
+    pwm_clock_stop(g);
+    pwm_stop(g);
+    dma_reset(g);
+    garage_carrier2_stop(g);
+}
+
+// stop the DMA but leave the carrier clock and PWM running at zero
+// amplitude, so the next program with the same carrier only needs a DMA
+// start. garage_stop() ends it.
+void garage_standby(struct garage_dev *g)
+{
+    g->air = NULL;
+    dma_reset(g);
+    garage_write(g, GARAGE_PWM, PWM_DMAC, 0);           // DREQ low
+    garage_write(g, GARAGE_PWM, PWM_DAT1, 0);           // carrier off
+    garage_write(g, GARAGE_CLK, PWMCLK_DIV, g->tx_clk_div); // undo FSK/sweep steps
+    gpio_clear(g, BUSY_LED_PIN);
+    if(test_bit(GARAGE_CARRIER2, &g->flags))
+        gpio_set_mode(g, CARRIER2_PIN, GPIO_MODE_IN);   // second carrier off
+
+    g->warm_clk_ctl = g->tx_clk_ctl;
+    g->warm_clk_div = g->tx_clk_div;
+    g->warm_clk2_div = g->tx_clk2_div;
+    set_bit(GARAGE_WARM, &g->flags);
+}
+
+// select carrier and sample rate for the next transmission
+int garage_set_tx(struct garage_dev *g, const struct garage_params *params)
+{
+    int err;
+
+    if(params->freq == 0 || params->srate == 0)
+        return -EINVAL;
+
+    // set PWM clock to 2x carrier frequency 
+    // (2x, because 101010...1010b serializer pattern divides clock frequency by two)
+    if((err = pwm_clock_calc(params->freq*2, &g->tx_clk_ctl, &g->tx_clk_div)) < 0)
+        return err;
+
+    g->tx = *params;
+
+    return 0;
+}
+
+// get carrier, PWM and DMA channel ready for a new program,
+// 'callback' is called on DMA interrupts
+int garage_prepare(struct garage_dev *g, garage_callback_t callback, int cyclic)
+{
+    u64 t0 = garage_now(g), t1;
+    u32 fsel;
+    int err;
+
+    // second carrier divisors, see gpclk_calc()
+    g->tx_clk2_ctl = 0;
+    g->tx_clk2_div = 0;
+    if(g->tx.carrier2 && (err = gpclk_calc(g->tx.carrier2, &g->tx_clk2_ctl, &g->tx_clk2_div)) < 0)
+        return err;
+
+    if(test_bit(GARAGE_WARM, &g->flags) &&
+            g->warm_clk_ctl == g->tx_clk_ctl && g->warm_clk_div == g->tx_clk_div &&
+            g->warm_clk2_div == g->tx_clk2_div) {
+        // standby with the same carrier: pins and clock are set up already
+        gpio_set(g, BUSY_LED_PIN);
+    } else {
+        gpio_set_mode(g, 18, 2);                // pin18 -> PWM out
+        gpio_set_mode(g, BUSY_LED_PIN, 1);      // GPIO out (busy led)
+        gpio_set(g, BUSY_LED_PIN);              // busy led ON
+
+        pwm_clock_set(g, g->tx_clk_ctl, g->tx_clk_div);
+
+        pwm_stop(g);
+
+        // the program switches the pin to GPCLK0 and back (add_fsel())
+        garage_carrier2_stop(g);
+        if(g->tx.carrier2) {
+            gpio_set_mode(g, CARRIER2_PIN, GPIO_MODE_IN);
+            gpclk_set(g, g->tx_clk2_ctl, g->tx_clk2_div);
+            set_bit(GARAGE_CARRIER2, &g->flags);
+        }
+    }
+    clear_bit(GARAGE_WARM, &g->flags);
+
+    // GPFSEL0 is written as a whole, so the other pins it covers keep the
+    // function they have now and must not be changed while on air
+    if(g->tx.carrier2) {
+        fsel = garage_read(g, GARAGE_GPIO, GPIO_REG_FSEL(CARRIER2_PIN)) & ~GPIO_FSEL(CARRIER2_PIN, 7);
+        g->buf[BUF_FSEL(0)] = fsel | GPIO_FSEL(CARRIER2_PIN, GPIO_MODE_IN);
+        g->buf[BUF_FSEL(1)] = fsel | GPIO_FSEL(CARRIER2_PIN, GPIO_MODE_ALT0);
+    }
+
+    pwm_init(g, 0); // (re)start PWM, but keep DREQ low
+
+    t1 = garage_now(g);
+    stats_record(g, STAGE_CLOCK, t1 - t0);
+
+    if((err = g->ops->chan_claim(g, callback, cyclic)) < 0) {
+        garage_stop(g);
+        return err;
+    }
+
+    stats_record(g, STAGE_CLAIM, garage_now(g) - t1);
+
+    return 0;
+}
+
+// spin briefly until the channel gets past the first paced CB of 'p',
+// just started by garage_fire(), to time the first DREQ. Gives up quietly
+// if it does not happen soon. Only with g->dreq_probe set (debugfs
+// dreq_probe), and never from the scheduled start's hard interrupt.
+void garage_probe_dreq(struct garage_dev *g, struct garage_prog *p)
+{
+    u32 addr, left, off;
+    int i, cb, first = p->first_dreq;
+
+    if(!READ_ONCE(g->dreq_probe) || first < 0)
+        return;
+
+    for(i=0;i<DREQ_POLL_READS && garage_now(g) - g->start_ns < DREQ_POLL_NS;i++) {
+        addr = garage_read(g, GARAGE_DMA, BCM2708_DMA_ADDR);
+        left = garage_read(g, GARAGE_DMA, DMA_TXFR_LEN);
+
+        if(addr == 0 || (cb = prog_cb_index(p, addr, &off)) < 0)
+            return;
+
+        // TXFR_LEN is stale (0) until the engine has loaded the CB
+        if(cb > first || (cb == first && left != 0 && left != prog_cb(p, first)->length)) {
+            stats_record(g, STAGE_DREQ, garage_now(g) - g->start_ns);
+            return;
+        }
+    }
+}
+
+// start executing CBs
+void garage_fire(struct garage_dev *g, struct garage_prog *p)
+{
+    u64 t0 = garage_now(g);
+
+    dma_reset(g);
+
+    // a repeated program may have been opened on its last run
+    if(p->loop) {
+        prog_cb(p, p->loop)->next = p->loop_next;
+        g->buf[BUF_DONE] = 0;
+    }
+    g->air = p;
+    g->repeat_left = g->tx.repeat;
+
+    health_arm(g);
+
+    dma_start(g, prog_cb_addr(p, 0));
+    g->start_ns = garage_now(g);
+
+    pwm_init(g, 1); // restart PWM, enable DMA
+
+    stats_record(g, STAGE_START, garage_now(g) - t0);
+
+    if(g->trigger_ns) {
+        stats_record(g, STAGE_TRIGGER, g->start_ns - g->trigger_ns);
+        g->trigger_ns = 0;
+    }
+}
+
+// Interrupt of a program on air. The frame of a repeated program ends with
+// an interrupt and links back to its start; once the last frame is on air
+// the loop is opened, so the program ends at a frame boundary. Returns
+// false at the end of a frame (the next one is on air already), true at
+// the end of the program. Frames shorter than the interrupt latency may
+// be sent once more than asked for.
+int garage_repeat_done(struct garage_dev *g)
+{
+    struct garage_prog *p = g->air;
+    int left;
+
+    if(p == NULL || p->loop == 0 || g->buf[BUF_DONE])
+        return 1;
+
+    left = READ_ONCE(g->repeat_left);
+    if(left == REPEAT_FOREVER)
+        return 0;
+
+    WRITE_ONCE(g->repeat_left, --left);
+
+    if(left <= 1) {
+        prog_cb(p, p->loop)->next = prog_cb_addr(p, p->loop + 1);
+        wmb();
+    }
+
+    return 0;
+}
@@ -0,0 +1,199 @@
+
+#ifndef __GARAGE_TYPES_H__
+#define __GARAGE_TYPES_H__
+
+// Types and helpers used by the hardware independent part of the driver
+// (CB builder, encoders, sequence parsers, PWM/clock/GPIO programming).
+// In the kernel they come from kernel headers, on the host they are
+// defined here, so that part can be built against the simulator in sim/.
+
+#ifdef __KERNEL__
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/ctype.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/bitops.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/spinlock.h>
+#include <linux/io.h>             // BCM2708_PERI_BASE, barriers
+#include <linux/dma-mapping.h>
+#include <linux/platform_data/dma-bcm2708.h>
+#include <asm/div64.h>
+#include <asm/unaligned.h>
+
+#else
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/types.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef uint32_t dma_addr_t;
+
+struct device;
+
+#define BIT(x)                  (1UL << (x))
+#define ARRAY_SIZE(a)           (sizeof(a)/sizeof((a)[0]))
+#define DIV_ROUND_UP(n, d)      (((n) + (d) - 1) / (d))
+#define DIV_ROUND_CLOSEST(n, d) (((n) + (d)/2) / (d))
+#define do_div(n, base)         ({ u32 __rem = (n) % (base); (n) /= (base); __rem; })
+#define wmb()                   __sync_synchronize()
+#define READ_ONCE(x)            (*(volatile typeof(x) *)&(x))
+#define WRITE_ONCE(x, val)      (*(volatile typeof(x) *)&(x) = (val))
+#define div_u64(n, base)        ((u64)(n) / (base))
+
+static inline u64 div_u64_rem(u64 n, u32 base, u32 *rem)
+{
+    *rem = n % base;
+    return n / base;
+}
+
+#define div64_u64(n, base)      ((u64)(n) / (u64)(base))
+#define U32_MAX                 UINT32_MAX
+#define INT_MAX                 INT32_MAX
+
+#define ilog2(n)                (31 - __builtin_clz(n))
+
+static inline int fls64(u64 x)
+{
+    return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+// the simulator is single threaded
+typedef int spinlock_t;
+#define spin_lock_init(lock)                    (*(lock) = 0)
+#define spin_lock_irqsave(lock, flags)          ((void)(lock), (flags) = 0)
+#define spin_unlock_irqrestore(lock, flags)     ((void)(lock), (void)(flags))
+
+#define set_bit(nr, addr)       (*(addr) |= BIT(nr))
+#define clear_bit(nr, addr)     (*(addr) &= ~BIT(nr))
+#define test_bit(nr, addr)      ((*(addr) >> (nr)) & 1)
+
+static inline int test_and_clear_bit(int nr, unsigned long *addr)
+{
+    int old = test_bit(nr, addr);
+
+    clear_bit(nr, addr);
+    return old;
+}
+
+#define GFP_KERNEL              0
+#define kmalloc_array(n, size, flags)   calloc((n), (size))
+#define kfree                   free
+
+#define KERN_INFO               ""
+#define printk                  printf
+#define dev_err(dev, ...)       fprintf(stderr, __VA_ARGS__)
+
+static inline u16 get_unaligned_le16(const void *p)
+{
+    const u8 *b = p;
+
+    return b[0] | b[1] << 8;
+}
+
+static inline u32 get_unaligned_le32(const void *p)
+{
+    const u8 *b = p;
+
+    return b[0] | b[1] << 8 | b[2] << 16 | (u32)b[3] << 24;
+}
+
+static inline int scnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list args;
+    int n;
+
+    if(size == 0)
+        return 0;
+
+    va_start(args, fmt);
+    n = vsnprintf(buf, size, fmt, args);
+    va_end(args);
+
+    return n < (int)size ? n : (int)size - 1;
+}
+
+// compare strings ignoring a trailing newline (as written to sysfs)
+static inline int sysfs_streq(const char *s1, const char *s2)
+{
+    while(*s1 && *s1 == *s2) {
+        s1++;
+        s2++;
+    }
+
+    if(*s1 == *s2)
+        return 1;
+    if(!*s1 && *s2 == '\n' && !s2[1])
+        return 1;
+    if(*s1 == '\n' && !s1[1] && !*s2)
+        return 1;
+
+    return 0;
+}
+
+// from <mach/platform.h>, Raspberry Pi 2/3
+#define BCM2708_PERI_BASE       0x3F000000
+#define DMA_BASE                (BCM2708_PERI_BASE + 0x7000)
+#define GPIO_BASE               (BCM2708_PERI_BASE + 0x200000)
+
+// from <linux/platform_data/dma-bcm2708.h>
+struct bcm2708_dma_cb {
+    u32 info;
+    u32 src;
+    u32 dst;
+    u32 length;
+    u32 stride;
+    u32 next;
+    u32 pad[2];
+};
+
+#define BCM2708_DMA_ACTIVE      BIT(0)
+#define BCM2708_DMA_INT         BIT(2)
+#define BCM2708_DMA_ISPAUSED    BIT(4)
+#define BCM2708_DMA_ISHELD      BIT(5)
+#define BCM2708_DMA_ERR         BIT(8)
+#define BCM2708_DMA_ABORT       BIT(30)
+#define BCM2708_DMA_RESET       BIT(31)
+
+#define BCM2708_DMA_INT_EN      BIT(0)
+#define BCM2708_DMA_TDMODE      BIT(1)
+#define BCM2708_DMA_WAIT_RESP   BIT(3)
+#define BCM2708_DMA_D_INC       BIT(4)
+#define BCM2708_DMA_D_WIDTH     BIT(5)
+#define BCM2708_DMA_D_DREQ      BIT(6)
+#define BCM2708_DMA_S_INC       BIT(8)
+#define BCM2708_DMA_S_WIDTH     BIT(9)
+#define BCM2708_DMA_S_DREQ      BIT(10)
+
+#define BCM2708_DMA_BURST(x)    (((x)&0xf) << 12)
+#define BCM2708_DMA_PER_MAP(x)  ((x) << 16)
+#define BCM2708_DMA_WAITS(x)    (((x)&0x1f) << 21)
+
+#define BCM2708_DMA_CS          0x00
+#define BCM2708_DMA_ADDR        0x04
+#define BCM2708_DMA_INFO        0x08
+#define BCM2708_DMA_SOURCE_AD   0x0c
+#define BCM2708_DMA_DEST_AD     0x10
+#define BCM2708_DMA_NEXTCB      0x1C
+#define BCM2708_DMA_DEBUG       0x20
+
+#endif
+
+#endif
@@ -0,0 +1,80 @@
+
+#ifndef __GARAGE_UAPI_H__
+#define __GARAGE_UAPI_H__
+
+// Interface of /dev/garage-door shared with userspace.
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// Each write() submits one sequence and returns immediately. Jobs are
+// numbered per open file in submission order, starting with 1.
+// Once a job is done, poll() reports POLLIN and read() returns its result.
+struct garage_result {
+    __u32 id;           // job number
+    __s32 status;       // 0 or negative errno
+    __u64 duration_ns;  // time on air
+    __s64 start_error_ns;   // scheduled jobs: actual minus requested DMA start
+};
+
+// Scheduled submission: the sequence goes on air at 'start_ns' rather than
+// as soon as possible. The ioctl returns the job number, the result is
+// read() as usual. Jobs the transmitter gets to after their start time
+// fail with -ETIME. Start times more than 60s ahead are -EINVAL. A job
+// waiting for its start time fails with -ECANCELED when 'stop' is written,
+// and is dropped when its file is closed.
+struct garage_timed {
+    __u64 start_ns;     // CLOCK_MONOTONIC, or CLOCK_TAI with GARAGE_TIMED_TAI
+    __u64 seq;          // pointer to the sequence
+    __u32 len;          // its length
+    __u32 flags;
+};
+
+#define GARAGE_TIMED_TAI        0x1
+
+#define GARAGE_IOC_SUBMIT_AT    _IOW('g', 1, struct garage_timed)
+
+// Mapped submission: mmap() of /dev/garage-door (offset 0, up to
+// GARAGE_MAP_SIZE bytes) is a sequence buffer of the open file, other
+// opens of the device have their own. GARAGE_IOC_KICK queues the 'len'
+// bytes at 'offset' of it as a sequence, without copying them, and
+// returns the job number (EINVAL if the buffer is not mapped). The bytes
+// are read when the job goes on air: from the ioctl until the job's
+// result is read they belong to the driver, and the client (any of its
+// threads) must not write them.
+struct garage_kick {
+    __u32 offset;
+    __u32 len;
+};
+
+#define GARAGE_MAP_SIZE         0x10000
+
+#define GARAGE_IOC_KICK         _IOW('g', 2, struct garage_kick)
+
+// Binary sequence format, accepted wherever an ASCII '0'/'1' sequence is.
+//
+// A 4 byte header (GS_MAGIC0, GS_MAGIC1, GS_VERSION, 0) is followed by ops.
+// Multi-byte fields are little endian.
+//
+//  GS_OP_BITS    u16 n, (n*b+7)/8 bytes n symbols of b bits packed MSB first
+//  GS_OP_RUN     u8 level, u32 n        n symbols of the same level (gaps)
+//  GS_OP_REPEAT  u16 n, ops, GS_OP_END  ops repeated n times, may be nested
+//  GS_OP_SEGMENT u8 level, u32 ns       level held for ns nanoseconds
+//
+// b is 1, 2 or 3 depending on the number of amplitude levels (2, 4 or 8).
+// Run lengths are at most 2^31-1 symbols, and a sequence may expand to at
+// most 2^20 ops, symbols of GS_OP_BITS and rounds of GS_OP_REPEAT (-E2BIG).
+// Segment ends are rounded to the nearest sample period, measured from
+// the start of the sequence, so rounding errors do not accumulate.
+#define GS_MAGIC0       'G'
+#define GS_MAGIC1       'S'
+#define GS_VERSION      1
+#define GS_HDR_LEN      4
+
+#define GS_OP_BITS      0x01
+#define GS_OP_RUN       0x02
+#define GS_OP_REPEAT    0x03
+#define GS_OP_END       0x04
+#define GS_OP_SEGMENT   0x05
+
+#endif
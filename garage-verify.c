@@ -0,0 +1,781 @@
+
+#include "garage-driver.h"
+#include "garage-dma.h"
+#include "garage-gpio.h"
+#include "garage-pwm.h"
+#include "garage-clk.h"
+#include "garage-seq.h"
+#include "garage-uapi.h"
+#include "garage-proto.h"
+#include "garage-verify.h"
+
+// CB chain verifier.
+//
+// Walks a compiled program the way the DMA engine would, and rebuilds
+// the carrier timeline from the PWM_DAT1 (and, for FSK, PWMCLK_DIV)
+// writes and the number of DREQ paced PWM_FIFO words between them. Comparing it with the
+// timeline the sequence is meant to produce checks the CB encoding,
+// independently of the hardware. That one is expanded here symbol by
+// symbol (verify_expect()), without the run-length builder or the line
+// encoders of garage-proto.c, so the compiler is not checked against itself.
+//
+// A repeated frame is followed around its loop verify_frames() times, the
+// way the driver would open it on the last one.
+//
+// With ENGINE_PACED a write lands as soon as the words before it are
+// queued, PACED_LEAD_WORDS samples before they are on air, and the
+// timeline is rebuilt that way: programs make up for it with a lead-in.
+// With ENGINE_FIFO the amplitude is in the FIFO words themselves, whose
+// counts are converted back to sample periods.
+//
+// A second carrier must be switched on (GPFSEL0) for every run with the
+// carrier on and off for every run without it, and be off at the end.
+
+void timeline_init(struct garage_timeline *t, struct garage_span *spans, int max)
+{
+    t->spans = spans;
+    t->max = max;
+    t->n = 0;
+    t->samples = 0;
+    t->irqs = 0;
+    t->steps = 0;
+}
+
+int timeline_add(struct garage_timeline *t, int level, u32 len)
+{
+    if(len == 0)
+        return 0;
+
+    if(t->n > 0 && t->spans[t->n-1].level == level) {
+        t->spans[t->n-1].len += len;
+    } else {
+        if(t->n == t->max)
+            return -ENOSPC;
+
+        t->spans[t->n].level = level;
+        t->spans[t->n].len = len;
+        t->n++;
+    }
+
+    t->samples += len;
+
+    return 0;
+}
+
+// 0 if both timelines are the same, otherwise 1 and the sample the first
+// difference is at
+int timeline_diff(const struct garage_timeline *want, const struct garage_timeline *got, u64 *at)
+{
+    const struct garage_span *a, *b;
+    u64 pos = 0;
+    int i;
+
+    for(i=0;i<want->n && i<got->n;i++) {
+        a = &want->spans[i];
+        b = &got->spans[i];
+
+        if(a->level != b->level) {
+            *at = pos;
+            return 1;
+        }
+
+        if(a->len != b->len) {
+            *at = pos + (a->len < b->len ? a->len : b->len);
+            return 1;
+        }
+
+        pos += a->len;
+    }
+
+    if(want->n != got->n) {
+        *at = pos;
+        return 1;
+    }
+
+    return 0;
+}
+
+// actual sample period: PWM_RNG2 PWM clocks, as set up by pwm_init() and
+// pwm_clock_calc() (the PWM clock runs from the 1GHz PLL)
+u64 timeline_period_ps(const struct garage_params *params, u32 clk_div)
+{
+    u64 width = 2*params->freq/params->srate;
+    u64 div = ((clk_div >> 12) & 0xfff)*4096 + (clk_div & 0xfff);
+
+    return div_u64(width*div*1000, 4096);
+}
+
+int timeline_print(const struct garage_timeline *t, u64 period_ps, char *buf, size_t size)
+{
+    u64 pos = 0, us;
+    char level[16];
+    u32 ns;
+    int i, n = 0;
+
+    for(i=0;i<t->n;i++) {
+        us = div_u64_rem(div_u64(t->spans[i].len*period_ps, 1000), 1000, &ns);
+
+        if(SPAN_IS_TONE(t->spans[i].level))
+            scnprintf(level, sizeof(level), "f%d", t->spans[i].level - SPAN_TONE(0));
+        else if(t->spans[i].level == 0 || t->spans[i].level == AMP_STEPS)
+            strcpy(level, t->spans[i].level ? "on" : "off");
+        else
+            scnprintf(level, sizeof(level), "%d/%d", t->spans[i].level, AMP_STEPS);
+
+        n += scnprintf(buf + n, size - n, "%8llu %-5s %8u %8llu.%03u us\n",
+                (unsigned long long)pos, level, t->spans[i].len,
+                (unsigned long long)us, ns);
+        pos += t->spans[i].len;
+    }
+
+    return n;
+}
+
+// frames of a repeated program followed by the checker, 1 if not repeated
+int verify_frames(const struct garage_params *params)
+{
+    if(!params_repeating(params))
+        return 1;
+
+    if(params->repeat == REPEAT_FOREVER || params->repeat > VERIFY_FRAMES)
+        return VERIFY_FRAMES;
+
+    return params->repeat;
+}
+
+// CBs are decoded from a copy 'cbs' of the program, the DMA may patch it
+static struct bcm2708_dma_cb *verify_cb(const struct garage_prog *p, struct bcm2708_dma_cb *cbs, dma_addr_t addr)
+{
+    u32 off;
+    int n = prog_cb_index(p, addr, &off);
+
+    if(n < 0 || off != 0)
+        return NULL;
+
+    return cbs + n;
+}
+
+// word of the CBs at bus address 'addr', NULL if outside of the program
+static u32 *verify_word(const struct garage_prog *p, struct bcm2708_dma_cb *cbs, dma_addr_t addr)
+{
+    u32 off;
+    int n = prog_cb_index(p, addr, &off);
+
+    if(n < 0 || off % 4)
+        return NULL;
+
+    return (u32 *)(cbs + n) + off/4;
+}
+
+// read a word the CBs transfer: the constant words or the CBs themselves
+static int verify_load(struct garage_dev *g, const struct garage_prog *p, struct bcm2708_dma_cb *cbs,
+        dma_addr_t addr, u32 *val)
+{
+    u32 *w;
+
+    if(addr >= g->buf_handle && addr < g->buf_handle + 4*BUF_WORDS) {
+        *val = g->buf[(addr - g->buf_handle)/4];
+        return 0;
+    }
+
+    if((w = verify_word(p, cbs, addr)) != NULL) {
+        *val = *w;
+        return 0;
+    }
+
+    return -EFAULT;
+}
+
+// amplitude step of a PWM1 pattern
+static int verify_amp(struct garage_dev *g, u32 val)
+{
+    int i;
+
+    for(i=0;i<=AMP_STEPS;i++) {
+        if(g->buf[BUF_AMP(i)] == val)
+            return i;
+    }
+
+    return -1;
+}
+
+// index of a PWMCLK_DIV word in 'divs' (tones or sweep steps)
+static int verify_div(const u32 *divs, int n, u32 val)
+{
+    int i;
+
+    for(i=0;i<n;i++) {
+        if(divs[i] == val)
+            return i;
+    }
+
+    return -1;
+}
+
+// number of words a CB transfers
+static u32 verify_words(const struct bcm2708_dma_cb *cb)
+{
+    if(cb->info & BCM2708_DMA_TDMODE)
+        return (cb->length & 0xffff)/4 * (((cb->length >> 16) & 0x3fff) + 1);
+
+    return cb->length/4;
+}
+
+// ENGINE_FIFO: the zero words pushing the last run out of the FIFO before
+// the final interrupt (see builder_finish()), not part of the sequence
+static int verify_tail(const struct garage_prog *p, struct bcm2708_dma_cb *cbs,
+        const struct bcm2708_dma_cb *cb, u32 val)
+{
+    const struct bcm2708_dma_cb *next = verify_cb(p, cbs, cb->next);
+
+    return val == 0 && verify_words(cb) == FIFO_TAIL_WORDS && next && (next->info & BCM2708_DMA_INT_EN);
+}
+
+// ENGINE_PACED: 'level' has been on air up to the write following the
+// 'queued'th word, which lands PACED_LEAD_WORDS samples before it would
+static int verify_lead(struct garage_timeline *t, int level, u64 queued)
+{
+    u64 end = queued > PACED_LEAD_WORDS ? queued - PACED_LEAD_WORDS : 0;
+
+    // a run swallowed by the lead is simply gone
+    if(end <= t->samples)
+        return 0;
+
+    return timeline_add(t, level, end - t->samples);
+}
+
+// rebuild the timeline of a program from its CBs
+int verify_decode(struct garage_dev *g, const struct garage_prog *p, const struct garage_params *params,
+        struct garage_timeline *t)
+{
+    struct bcm2708_dma_cb *cbs, *cb;
+    dma_addr_t addr = prog_cb_addr(p, 0);
+    int steps, max, level = 0, amp, ndivs = 0, frames = verify_frames(params), err = 0;
+    int fifo = params->engine == ENGINE_FIFO, keyed = 0;
+    u32 val = 0, *w, divs[SWEEP_MAX];
+    u64 width = 2*params->freq/params->srate, words = 0, base = 0, end, queued = 0;
+
+    if(params->mod == MOD_FSK)
+        ndivs = pwm_tone_calc(params, divs);
+    else if(params->sweep_step)
+        ndivs = pwm_sweep_calc(params, divs);
+    if(ndivs < 0)
+        return ndivs;
+
+    // a sweep runs the frame once per step
+    max = p->sample * (params->sweep_step ? ndivs : frames);
+
+    cbs = kmalloc_array(p->sample, sizeof(*cbs), GFP_KERNEL);
+    if(cbs == NULL)
+        return -ENOMEM;
+    for(steps=0;steps<p->sample;steps++)
+        cbs[steps] = *prog_cb(p, steps);
+
+    for(steps=0;addr;steps++) {
+        if(steps >= max) {
+            dev_err(g->dev, "error: CB chain does not end\n");
+            err = -ELOOP;
+            goto out;
+        }
+
+        // the FIFO words of a repeated frame count from its start, every round
+        if(p->loop && addr == p->loop_next) {
+            words = 0;
+            base = t->samples;
+        }
+
+        if((cb = verify_cb(p, cbs, addr)) == NULL) {
+            dev_err(g->dev, "error: CB %d links outside of the program (0x%08x)\n", steps, addr);
+            err = -EFAULT;
+            goto out;
+        }
+
+        if(cb->dst == PHYS_TO_DMA(PWM_BASE + PWM_DAT1) ||
+                cb->dst == PHYS_TO_DMA(CLK_BASE + PWMCLK_DIV) ||
+                (fifo && cb->dst == PHYS_TO_DMA(PWM_BASE + PWM_FIFO)) ||
+                verify_word(p, cbs, cb->dst) != NULL) {
+            if((err = verify_load(g, p, cbs, cb->src, &val)) < 0) {
+                dev_err(g->dev, "error: CB %d reads unknown address 0x%08x\n", steps, cb->src);
+                goto out;
+            }
+        }
+
+        if(cb->dst == PHYS_TO_DMA(PWM_BASE + PWM_DAT1)) {
+            if((amp = verify_amp(g, val)) < 0) {
+                dev_err(g->dev, "error: CB %d writes unknown PWM1 pattern 0x%08x\n", steps, val);
+                err = -EINVAL;
+                goto out;
+            }
+            if(!fifo && (err = verify_lead(t, level, queued)) < 0)
+                goto out;
+            level = amp;
+        } else if(cb->dst == PHYS_TO_DMA(CLK_BASE + PWMCLK_DIV)) {
+            if((amp = verify_div(divs, ndivs, val)) < 0) {
+                dev_err(g->dev, "error: CB %d writes unknown PWM clock divisor 0x%08x\n", steps, val);
+                err = -EINVAL;
+                goto out;
+            }
+
+            if(params->mod == MOD_FSK) {
+                if(!fifo && (err = verify_lead(t, level, queued)) < 0)
+                    goto out;
+                level = SPAN_TONE(amp);
+            } else {
+                // every step runs the same frame, counted from its start
+                t->steps++;
+                words = 0;
+                base = t->samples;
+            }
+        } else if(cb->dst == PHYS_TO_DMA(PWM_BASE + PWM_FIFO)) {
+            // not paced by PWM2 the words would be gone in no time
+            if(!(cb->info & BCM2708_DMA_D_DREQ) || ((cb->info >> 16) & 0x1f) != 5) {
+                dev_err(g->dev, "error: CB %d writes PWM FIFO without DREQ\n", steps);
+                err = -EINVAL;
+                goto out;
+            }
+
+            if(!fifo) {
+                if(params->carrier2 && keyed != (level > 0)) {
+                    dev_err(g->dev, "error: CB %d runs with the second carrier %s\n", steps, keyed ? "on" : "off");
+                    err = -EINVAL;
+                    goto out;
+                }
+                queued += verify_words(cb);
+            } else if(!verify_tail(p, cbs, cb, val)) {
+                if((amp = verify_amp(g, val)) < 0) {
+                    dev_err(g->dev, "error: CB %d feeds unknown PWM1 pattern 0x%08x\n", steps, val);
+                    err = -EINVAL;
+                    goto out;
+                }
+                if(params->mod != MOD_FSK)
+                    level = amp;
+
+                // back to sample periods, rounded like builder_fifo_run()
+                words += verify_words(cb);
+                end = base + div64_u64(words*32 + width/2, width);
+                if((err = timeline_add(t, level, end - t->samples)) < 0)
+                    goto out;
+            }
+        } else if(cb->dst == PHYS_TO_DMA(GPIO_BASE + GPIO_REG_FSEL(CARRIER2_PIN)) && params->carrier2) {
+            if(cb->src == g->buf_handle+4*BUF_FSEL(0) || cb->src == g->buf_handle+4*BUF_FSEL(1)) {
+                keyed = cb->src == g->buf_handle+4*BUF_FSEL(1);
+            } else {
+                dev_err(g->dev, "error: CB %d writes unknown GPFSEL0 word\n", steps);
+                err = -EINVAL;
+                goto out;
+            }
+        } else if((w = verify_word(p, cbs, cb->dst)) != NULL) {
+            // patches the program (sweep relinking), one word at most
+            if(verify_words(cb) != 1) {
+                dev_err(g->dev, "error: CB %d overwrites the program\n", steps);
+                err = -EINVAL;
+                goto out;
+            }
+            *w = val;
+        }
+
+        if(cb->info & BCM2708_DMA_INT_EN)
+            t->irqs++;
+
+        addr = cb->next;
+
+        if(p->loop && cb == cbs + p->loop && addr == p->loop_next) {
+            // the driver opens the loop once the last frame is on air
+            if(--frames == 1)
+                cb->next = prog_cb_addr(p, p->loop + 1);
+        }
+    }
+
+    if(keyed) {
+        dev_err(g->dev, "error: program ends with the second carrier on\n");
+        err = -EINVAL;
+        goto out;
+    }
+
+    // the final interrupt is as early as the writes
+    if(!fifo && (err = verify_lead(t, level, queued)) < 0)
+        goto out;
+
+    err = 0;
+
+out:
+    kfree(cbs);
+    return err;
+}
+
+// reference expansion of a sequence, one symbol at a time
+struct verify_ref {
+    struct garage_timeline *t;
+    int levels;             // symbol alphabet
+    int fsk;                // symbols are tones
+    u64 period_ps;          // sample period
+    u64 ticks;              // sample periods expanded in this frame
+    u64 exact_ps;           // where they should end
+    u32 ops;                // binary ops and symbols expanded in this frame
+    const struct ref_encoder *enc;  // line encoder reference, NULL without
+};
+
+// 'len' sample periods of symbol 'sym'
+static int ref_symbol(struct verify_ref *r, int sym, u32 len)
+{
+    int level;
+
+    if(sym < 0 || sym >= r->levels)
+        return -EINVAL;
+
+    // the amplitude of symbol 'sym' is sym/(levels-1) of full, to the nearest step
+    level = r->fsk ? SPAN_TONE(sym) : DIV_ROUND_CLOSEST(sym*AMP_STEPS, r->levels - 1);
+    r->ticks += len;
+
+    return timeline_add(r->t, level, len);
+}
+
+// 'len' symbols long
+static int ref_emit(struct verify_ref *r, int sym, u32 len)
+{
+    r->exact_ps += (u64)len*r->period_ps;
+
+    return ref_symbol(r, sym, len);
+}
+
+// 'ns' long, ending on the nearest sample period boundary
+static int ref_segment(struct verify_ref *r, int sym, u32 ns)
+{
+    u64 end;
+
+    r->exact_ps += (u64)ns*1000;
+    end = div64_u64(r->exact_ps + r->period_ps/2, r->period_ps);
+    if(end <= r->ticks)
+        return 0;
+
+    return ref_symbol(r, sym, end - r->ticks);
+}
+
+// one symbol per '0' (carrier off) or '1' (full) of 'bits'
+static int ref_bits(struct verify_ref *r, const char *bits)
+{
+    int err;
+
+    for(;*bits;bits++) {
+        if((err = ref_emit(r, *bits == '1' ? r->levels - 1 : 0, 1)) < 0)
+            return err;
+    }
+
+    return 0;
+}
+
+// next character of a code in upper case, white space skipped, 0 at its end
+static int ref_code_next(const u8 *code, size_t len, size_t *i)
+{
+    int c;
+
+    while(*i < len && code[*i]) {
+        c = code[(*i)++];
+        if(c == ' ' || (c >= '\t' && c <= '\r'))
+            continue;
+
+        return c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c;
+    }
+
+    return 0;
+}
+
+// triplet, the framing test.sh used to spell out: the code between two 0
+// bits, every bit b sent as 1, 0, not b, and the carrier on for 5 periods
+static int ref_triplet(struct verify_ref *r, const u8 *code, size_t len)
+{
+    char bits[4] = "10?";
+    size_t i = 0;
+    int c, err, first = 1, last = 0;
+
+    while(!last) {
+        if(first)
+            c = '0', first = 0;
+        else if((c = ref_code_next(code, len, &i)) == 0)
+            c = '0', last = 1;
+        if(c != '0' && c != '1')
+            return -EINVAL;
+
+        bits[2] = c == '0' ? '1' : '0';
+        if((err = ref_bits(r, bits)) < 0)
+            return err;
+    }
+
+    return ref_bits(r, "11111");
+}
+
+// Manchester (IEEE 802.3): 0 falls mid bit, 1 rises, then 8 periods off
+static int ref_manchester(struct verify_ref *r, const u8 *code, size_t len)
+{
+    size_t i = 0;
+    int c, err;
+
+    while((c = ref_code_next(code, len, &i)) != 0) {
+        if(c != '0' && c != '1')
+            return -EINVAL;
+        if((err = ref_bits(r, c == '0' ? "10" : "01")) < 0)
+            return err;
+    }
+
+    return ref_bits(r, "00000000");
+}
+
+// PT2262: a bit is two pulses, 1 (short) or 3 (long) periods on out of 4.
+// 0 is short-short, 1 long-long and F short-long. Then a short sync pulse
+// and 31 periods off
+static int ref_tristate(struct verify_ref *r, const u8 *code, size_t len)
+{
+    static const char *const pulse[] = { "1000", "1110" };
+    size_t i = 0;
+    int c, err, a, b;
+
+    while((c = ref_code_next(code, len, &i)) != 0) {
+        if(c == '0')
+            a = 0, b = 0;
+        else if(c == '1')
+            a = 1, b = 1;
+        else if(c == 'F')
+            a = 0, b = 1;
+        else
+            return -EINVAL;
+
+        if((err = ref_bits(r, pulse[a])) < 0 || (err = ref_bits(r, pulse[b])) < 0)
+            return err;
+    }
+
+    if((err = ref_bits(r, "1")) < 0)
+        return err;
+
+    return ref_emit(r, 0, 31);
+}
+
+// the built-in line encoders, written out again rather than taken from
+// garage-proto.c, so that their output is checked as well
+static const struct ref_encoder {
+    const char *name;
+    const char *preamble;   // before the first frame
+    const char *postamble;  // after the last one
+    int (*frame)(struct verify_ref *r, const u8 *code, size_t len);
+} ref_encoders[] = {
+    { "triplet",    "1111", "0", ref_triplet },
+    { "manchester", "",     "0", ref_manchester },
+    { "tristate",   "",     "0", ref_tristate },
+};
+
+static const struct ref_encoder *ref_encoder(const struct garage_params *params)
+{
+    int i;
+
+    for(i=0;i<ARRAY_SIZE(ref_encoders);i++) {
+        if(strcmp(ref_encoders[i].name, params->enc->name) == 0)
+            return &ref_encoders[i];
+    }
+
+    return NULL;
+}
+
+// binary ops up to GS_OP_END or the end of buffer, as documented in
+// garage-uapi.h
+static int ref_block(struct verify_ref *r, const u8 *buf, size_t len, size_t *pos, int depth)
+{
+    int bps = ilog2(r->levels), count, err, sym;
+    size_t start, i, n;
+    u32 off;
+
+    while(*pos < len) {
+        if(++r->ops > SEQ_MAX_OPS)
+            return -E2BIG;
+
+        switch(buf[(*pos)++]) {
+            case GS_OP_BITS:
+                if(*pos + 2 > len)
+                    return -EINVAL;
+                n = get_unaligned_le16(buf + *pos);
+                *pos += 2;
+                if(*pos + DIV_ROUND_UP(n*bps, 8) > len || (r->ops += n) > SEQ_MAX_OPS)
+                    return -EINVAL;
+
+                for(i=0;i<n;i++) {
+                    for(sym=0,off=i*bps;off<(i+1)*bps;off++)
+                        sym = sym << 1 | ((buf[*pos + off/8] >> (7 - off%8)) & 1);
+                    if((err = ref_emit(r, sym, 1)) < 0)
+                        return err;
+                }
+                *pos += DIV_ROUND_UP(n*bps, 8);
+                break;
+
+            case GS_OP_RUN:
+            case GS_OP_SEGMENT:
+                if(*pos + 5 > len)
+                    return -EINVAL;
+                if(buf[*pos - 1] == GS_OP_RUN)
+                    err = ref_emit(r, buf[*pos], get_unaligned_le32(buf + *pos + 1));
+                else
+                    err = ref_segment(r, buf[*pos], get_unaligned_le32(buf + *pos + 1));
+                if(err < 0)
+                    return err;
+                *pos += 5;
+                break;
+
+            case GS_OP_REPEAT:
+                if(*pos + 2 > len || depth >= SEQ_MAX_DEPTH)
+                    return -EINVAL;
+                count = get_unaligned_le16(buf + *pos);
+                *pos += 2;
+
+                for(start=*pos;count>0;count--) {
+                    *pos = start;
+                    if(++r->ops > SEQ_MAX_OPS)
+                        return -E2BIG;
+                    if((err = ref_block(r, buf, len, pos, depth + 1)) < 0)
+                        return err;
+                }
+                break;
+
+            case GS_OP_END:
+                return depth > 0 ? 0 : -EINVAL;
+
+            default:
+                return -EINVAL;
+        }
+    }
+
+    return depth > 0 ? -EINVAL : 0;
+}
+
+// one frame of a code, a binary or an ASCII sequence
+static int ref_frame(struct verify_ref *r, const struct garage_params *params, const u8 *buf, size_t len)
+{
+    size_t pos = GS_HDR_LEN;
+    int err = 0;
+
+    r->ticks = 0;
+    r->exact_ps = 0;
+    r->ops = 0;
+
+    if(params->enc)
+        return r->enc->frame(r, buf, len);
+
+    if(len >= GS_HDR_LEN && buf[0] == GS_MAGIC0 && buf[1] == GS_MAGIC1)
+        return buf[2] == GS_VERSION ? ref_block(r, buf, len, &pos, 0) : -EINVAL;
+
+    for(pos=0;pos<len && buf[pos] && err == 0;pos++) {
+        if(buf[pos] >= '0' && buf[pos] < '0' + r->levels)
+            err = ref_emit(r, buf[pos] - '0', 1);
+    }
+
+    return err;
+}
+
+// the timeline 'buf' is meant to produce, over 'frames' frames (the
+// repeated frames followed, or the sweep steps). The preamble and
+// postamble of a line encoder go around the repeated frames, and around
+// every sweep step.
+static int verify_expect(struct garage_timeline *t, const struct garage_params *params, u64 period_ps,
+        int frames, const u8 *buf, size_t len)
+{
+    struct verify_ref r = {
+        .t = t,
+        .levels = params->levels ? params->levels : 2,
+        .fsk = params->mod == MOD_FSK,
+        .period_ps = period_ps,
+    };
+    const char *pre = "", *post = "";
+    int err, sweep = params->sweep_step != 0;
+
+    if(r.fsk)
+        r.levels = params->ntones;
+
+    if(params->enc) {
+        if((r.enc = ref_encoder(params)) == NULL)
+            return -ENOENT;
+        pre = r.enc->preamble;
+        post = r.enc->postamble;
+    }
+
+    if(!sweep && (err = ref_bits(&r, pre)) < 0)
+        return err;
+
+    while(frames-- > 0) {
+        // carrier off while the divider of a sweep step changes
+        if(sweep && ((err = ref_emit(&r, 0, PACED_LEAD_WORDS)) < 0 || (err = ref_bits(&r, pre)) < 0))
+            return err;
+        if((err = ref_frame(&r, params, buf, len)) < 0)
+            return err;
+        if(sweep && (err = ref_bits(&r, post)) < 0)
+            return err;
+    }
+
+    return sweep ? 0 : ref_bits(&r, post);
+}
+
+// check program 'p' produces 'buf', write a report and the decoded timeline
+// to 'report'. Returns 0 when they match, 1 if not, or a negative error.
+int verify_sequence(struct garage_dev *g, const struct garage_prog *p, const struct garage_params *params,
+        const u8 *buf, size_t len, char *report, size_t size)
+{
+    struct garage_timeline want, got;
+    struct garage_span *spans;
+    u32 clk_ctl, clk_div, divs[SWEEP_MAX];
+    u64 period, at;
+    int err, n = 0, ret = 0, max, reps = 1, irqs;
+
+    if((err = pwm_clock_calc(params->freq*2, &clk_ctl, &clk_div)) < 0)
+        return err;
+
+    period = timeline_period_ps(params, clk_div);
+
+    if(params->sweep_step && params->mod != MOD_FSK) {
+        if((reps = pwm_sweep_calc(params, divs)) < 0)
+            return reps;
+    } else {
+        reps = verify_frames(params);
+    }
+
+    // the final one, and one per repeated frame
+    irqs = params_repeating(params) ? reps + 1 : 1;
+
+    // a program never has more spans than half its CBs (all of them with
+    // ENGINE_FIFO), per frame repetition
+    max = reps*(p->max/(params->engine == ENGINE_FIFO ? 1 : 2) + 1);
+    spans = kmalloc_array(2*max, sizeof(*spans), GFP_KERNEL);
+    if(spans == NULL)
+        return -ENOMEM;
+
+    timeline_init(&got, spans, max);
+    timeline_init(&want, spans + max, max);
+
+    if((err = verify_decode(g, p, params, &got)) < 0)
+        goto out;
+
+    err = verify_expect(&want, params, period, reps, buf, len);
+    if(err < 0 && err != -ENOSPC)
+        goto out;
+
+    n += scnprintf(report + n, size - n, "program: %d CBs, %d spans, %llu samples, %d irq\n",
+            p->sample, got.n, (unsigned long long)got.samples, got.irqs);
+    n += scnprintf(report + n, size - n, "expected: %d%s spans, %llu samples\n",
+            want.n, err == -ENOSPC ? "+" : "", (unsigned long long)want.samples);
+    if(got.steps)
+        n += scnprintf(report + n, size - n, "carrier sweep: %d steps\n", got.steps);
+
+    if(err == -ENOSPC || timeline_diff(&want, &got, &at)) {
+        if(err == -ENOSPC)
+            at = want.samples;
+        n += scnprintf(report + n, size - n, "MISMATCH at sample %llu (%llu us)\n",
+                (unsigned long long)at, (unsigned long long)div_u64(at*period, 1000000));
+        ret = 1;
+    } else if(got.irqs != irqs) {
+        n += scnprintf(report + n, size - n, "MISMATCH: %d interrupts, expected %d\n", got.irqs, irqs);
+        ret = 1;
+    } else {
+        n += scnprintf(report + n, size - n, "OK\n");
+    }
+
+    timeline_print(&got, period, report + n, size - n);
+    err = ret;
+
+out:
+    kfree(spans);
+    return err;
+}
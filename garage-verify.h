@@ -0,0 +1,43 @@
+
+#ifndef __GARAGE_VERIFY_H__
+#define __GARAGE_VERIFY_H__
+
+struct garage_dev;
+struct garage_prog;
+struct garage_params;
+
+// FSK spans are tagged with the tone instead of an amplitude
+#define SPAN_TONE(n)        (0x100 + (n))
+#define SPAN_IS_TONE(level) ((level) >= SPAN_TONE(0))
+
+// a repeated frame is checked this many times at most
+#define VERIFY_FRAMES       3
+
+// a period of constant carrier level
+struct garage_span {
+    int level;              // PWM1 amplitude, 0 (carrier off) to AMP_STEPS, or SPAN_TONE()
+    u32 len;                // in sample periods
+};
+
+// carrier on/off timeline, adjacent spans of the same level are merged
+struct garage_timeline {
+    struct garage_span *spans;
+    int n, max;
+    u64 samples;            // total length, in sample periods
+    int irqs;               // CBs raising an interrupt
+    int steps;              // carrier sweep steps
+};
+
+void timeline_init(struct garage_timeline *t, struct garage_span *spans, int max);
+int timeline_add(struct garage_timeline *t, int level, u32 len);
+int timeline_diff(const struct garage_timeline *want, const struct garage_timeline *got, u64 *at);
+u64 timeline_period_ps(const struct garage_params *params, u32 clk_div);
+int timeline_print(const struct garage_timeline *t, u64 period_ps, char *buf, size_t size);
+
+int verify_frames(const struct garage_params *params);
+int verify_decode(struct garage_dev *g, const struct garage_prog *p, const struct garage_params *params,
+        struct garage_timeline *t);
+int verify_sequence(struct garage_dev *g, const struct garage_prog *p, const struct garage_params *params,
+        const u8 *buf, size_t len, char *report, size_t size);
+
+#endif
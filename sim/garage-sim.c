@@ -0,0 +1,581 @@
+
+#include <stdlib.h>
+
+#include "garage-driver.h"
+#include "garage-dma.h"
+#include "garage-gpio.h"
+#include "garage-pwm.h"
+#include "garage-clk.h"
+#include "garage-sim.h"
+
+// Userspace model of the peripherals used by the driver.
+//
+// Registers are plain arrays. The DMA channel walks CBs out of memory
+// handed out by sim_dma_alloc(), writes to PWM_FIFO with PER_MAP(5) are
+// paced by the PWM2 channel popping one word every RNG2 PWM clocks (or
+// PWM1 every RNG1 clocks when it serializes out of the FIFO), and
+// the PWM clock is derived from PWMCLK_CNTL/PWMCLK_DIV. Time only exists
+// in the model, so a 1 second transmission is simulated in microseconds.
+
+#define SIM_REG_WORDS   64
+#define SIM_BUS_BASE    0xC0000000      // uncached alias, like the real allocations
+#define SIM_MAX_REGIONS (CBS_LIMIT/CB_CHUNK + 16)   // every CB chunk of a program, and the buffers
+#define SIM_FIFO_DEPTH  8
+
+#define GPIO_LEV0       0x34
+
+struct sim_region {
+    dma_addr_t bus;
+    size_t size;
+    void *cpu;
+};
+
+struct sim_state {
+    u32 regs[GARAGE_NBLOCKS][SIM_REG_WORDS];
+
+    struct sim_region regions[SIM_MAX_REGIONS];
+    int nregions;
+    dma_addr_t next_bus;
+
+    garage_callback_t callback;
+    int cyclic;
+    int called;                         // non-cyclic callback has fired
+
+    u64 now_ps;                         // model time
+    int fifo_len;                       // words waiting in the PWM FIFO
+    u64 pwm_busy_ps;                    // the FIFO channel serialises the current word until then
+    int fifo_primed;                    // no word since CLRF, an empty FIFO is not a gap yet
+    int dma_writing;                    // register writes come from a CB
+
+    struct sim_event *events;
+    int nevents, maxevents;
+};
+
+static struct sim_state *sim(struct garage_dev *g)
+{
+    return g->sim;
+}
+
+static void sim_record(struct garage_dev *g, int block, u32 offset, u32 val)
+{
+    struct sim_state *s = sim(g);
+    struct sim_event *ev;
+
+    if(s->nevents == s->maxevents) {
+        s->maxevents = s->maxevents ? 2*s->maxevents : 256;
+        s->events = realloc(s->events, sizeof(*s->events)*s->maxevents);
+        if(s->events == NULL) {
+            fprintf(stderr, "sim: out of memory\n");
+            abort();
+        }
+    }
+
+    ev = &s->events[s->nevents++];
+    ev->t_ns = s->now_ps/1000;
+    ev->dma = s->dma_writing;
+    ev->block = block;
+    ev->offset = offset;
+    ev->val = val;
+}
+
+static u32 sim_read(struct garage_dev *g, int block, u32 offset)
+{
+    struct sim_state *s = sim(g);
+
+    if(block < 0 || block >= GARAGE_NBLOCKS || offset/4 >= SIM_REG_WORDS)
+        return 0;
+
+    // set and clear registers are write only
+    if(block == GARAGE_GPIO && offset >= GPIO_REG_SET(0) && offset <= GPIO_REG_CLEAR(32))
+        return 0;
+
+    return s->regs[block][offset/4];
+}
+
+static void sim_dma_cs(struct sim_state *s, u32 val)
+{
+    u32 *dma = s->regs[GARAGE_DMA];
+
+    if(val & BCM2708_DMA_RESET) {
+        memset(dma, 0, sizeof(s->regs[GARAGE_DMA]));
+        return;
+    }
+
+    if(val & BCM2708_DMA_ABORT)
+        dma[BCM2708_DMA_ADDR/4] = 0;
+
+    // INT and END are write 1 to clear
+    dma[BCM2708_DMA_CS/4] &= ~(val & (BCM2708_DMA_INT | BIT(1)));
+
+    if(val & BCM2708_DMA_ACTIVE)
+        dma[BCM2708_DMA_CS/4] |= BCM2708_DMA_ACTIVE;
+    else
+        dma[BCM2708_DMA_CS/4] &= ~BCM2708_DMA_ACTIVE;
+}
+
+static void sim_write(struct garage_dev *g, int block, u32 offset, u32 val)
+{
+    struct sim_state *s = sim(g);
+    u32 *regs;
+
+    if(block < 0 || block >= GARAGE_NBLOCKS || offset/4 >= SIM_REG_WORDS)
+        return;
+
+    regs = s->regs[block];
+    sim_record(g, block, offset, val);
+
+    switch(block) {
+        case GARAGE_GPIO:
+            if(offset == GPIO_REG_SET(0))
+                regs[GPIO_LEV0/4] |= val;
+            else if(offset == GPIO_REG_CLEAR(0))
+                regs[GPIO_LEV0/4] &= ~val;
+            else
+                regs[offset/4] = val;
+            return;
+
+        case GARAGE_PWM:
+            if(offset == PWM_CTRL && (val & PWMCTRL_CLRF)) {
+                s->fifo_len = 0;
+                s->pwm_busy_ps = s->now_ps;
+                s->fifo_primed = 1;
+                val &= ~PWMCTRL_CLRF;
+            }
+            if(offset == PWM_STAT) {
+                regs[offset/4] &= ~val;     // write 1 to clear
+                return;
+            }
+            if(offset == PWM_FIFO)
+                return;     // only DMA writes to the FIFO are modelled
+            regs[offset/4] = val;
+            return;
+
+        case GARAGE_CLK:
+            // the clock manager ignores writes without the password
+            if((val & 0xff000000) == CLK_PASSWD)
+                regs[offset/4] = val & 0x00ffffff;
+            return;
+
+        case GARAGE_DMA:
+            if(offset == BCM2708_DMA_CS)
+                sim_dma_cs(s, val);
+            else if(offset == BCM2708_DMA_DEBUG)
+                regs[offset/4] &= ~val;     // write 1 to clear
+            else
+                regs[offset/4] = val;
+            return;
+    }
+}
+
+u64 sim_pwm_clock(struct garage_dev *g)
+{
+    struct sim_state *s = sim(g);
+    u32 ctl = s->regs[GARAGE_CLK][PWMCLK_CNTL/4];
+    u32 div = s->regs[GARAGE_CLK][PWMCLK_DIV/4];
+    u64 src, divi, divf;
+
+    if(!(ctl & CLKCNTL_ENAB))
+        return 0;
+
+    switch(ctl & 0xf) {
+        case PLL_192MHZ: src = 19200000; break;
+        case PLL_1GHZ: src = 1000000000; break;
+        case PLL_500MHZ: src = 500000000; break;
+        default: return 0;
+    }
+
+    divi = (div >> 12) & 0xfff;
+    divf = div & 0xfff;
+
+    // MASH dithers between DIVI and DIVI+1, only the average is modelled
+    if(((ctl >> 9) & 3) == 0)
+        divf = 0;
+
+    if(divi == 0)
+        return 0;
+
+    return src*4096/(divi*4096 + divf);
+}
+
+// time the FIFO channel takes to serialise one FIFO word: RNG2 clocks for
+// PWM2 (pacing), RNG1 for PWM1 (ENGINE_FIFO), 0 if the FIFO is not used
+static u64 sim_pwm_period_ps(struct garage_dev *g)
+{
+    struct sim_state *s = sim(g);
+    u32 ctrl = s->regs[GARAGE_PWM][PWM_CTRL/4];
+    u64 clk = sim_pwm_clock(g);
+    u64 rng;
+
+    if((ctrl & PWMCTRL_PWEN1) && (ctrl & PWMCTRL_USEF1))
+        rng = s->regs[GARAGE_PWM][PWM_RNG1/4];
+    else if((ctrl & PWMCTRL_PWEN2) && (ctrl & PWMCTRL_USEF2))
+        rng = s->regs[GARAGE_PWM][PWM_RNG2/4];
+    else
+        return 0;
+
+    if(clk == 0 || rng == 0)
+        return 0;
+
+    return rng*1000000000000ULL/clk;
+}
+
+// PWM_STAT gap bit of the channel serialising the FIFO
+static u32 sim_pwm_gap(struct garage_dev *g)
+{
+    u32 ctrl = sim(g)->regs[GARAGE_PWM][PWM_CTRL/4];
+
+    return (ctrl & PWMCTRL_PWEN1) && (ctrl & PWMCTRL_USEF1) ? PWMSTAT_GAPO1 : PWMSTAT_GAPO2;
+}
+
+// feed one word to the PWM FIFO once DREQ allows it, false if it never will
+static int sim_fifo_push(struct garage_dev *g)
+{
+    struct sim_state *s = sim(g);
+    u32 dmac = s->regs[GARAGE_PWM][PWM_DMAC/4];
+    int thresh = dmac & 0xff;
+    u64 period = sim_pwm_period_ps(g);
+
+    if(!(dmac & PWMDMAC_ENAB) || period == 0)
+        return 0;
+
+    if(thresh < 1)
+        thresh = 1;
+    if(thresh > SIM_FIFO_DEPTH)
+        thresh = SIM_FIFO_DEPTH;
+
+    // DREQ is asserted while the FIFO holds less than 'thresh' words,
+    // the channel pulls the next word every 'period'
+    while(s->fifo_len >= thresh) {
+        if(s->now_ps < s->pwm_busy_ps)
+            s->now_ps = s->pwm_busy_ps;
+        s->fifo_len--;
+        s->pwm_busy_ps += period;
+    }
+
+    if(s->fifo_len == 0 && s->pwm_busy_ps <= s->now_ps) {
+        // the serializer ran out of words before this one came
+        if(s->pwm_busy_ps < s->now_ps && !s->fifo_primed)
+            s->regs[GARAGE_PWM][PWM_STAT/4] |= sim_pwm_gap(g);
+        s->pwm_busy_ps = s->now_ps + period;   // straight into the serializer
+    } else {
+        s->fifo_len++;
+    }
+    s->fifo_primed = 0;
+
+    return 1;
+}
+
+void *sim_bus_to_virt(struct garage_dev *g, dma_addr_t bus, size_t len)
+{
+    struct sim_state *s = sim(g);
+    struct sim_region *r;
+    int i;
+
+    for(i=0;i<s->nregions;i++) {
+        r = &s->regions[i];
+        if(r->cpu && bus >= r->bus && bus - r->bus + len <= r->size)
+            return (u8 *)r->cpu + (bus - r->bus);
+    }
+
+    return NULL;
+}
+
+// map a peripheral bus address to a register block
+static int sim_periph(dma_addr_t bus, u32 *offset)
+{
+    static const struct {
+        u32 base;
+        int block;
+    } map[] = {
+        { PHYS_TO_DMA(GPIO_BASE), GARAGE_GPIO },
+        { PHYS_TO_DMA(PWM_BASE), GARAGE_PWM },
+        { PHYS_TO_DMA(CLK_BASE), GARAGE_CLK },
+    };
+    int i;
+
+    for(i=0;i<ARRAY_SIZE(map);i++) {
+        if(bus >= map[i].base && bus < map[i].base + 4*SIM_REG_WORDS) {
+            *offset = bus - map[i].base;
+            return map[i].block;
+        }
+    }
+
+    return -1;
+}
+
+static int sim_load(struct garage_dev *g, dma_addr_t bus, u32 *val)
+{
+    u32 *p, offset;
+    int block;
+
+    if((p = sim_bus_to_virt(g, bus, 4)) != NULL) {
+        *val = *p;
+        return 0;
+    }
+
+    if((block = sim_periph(bus, &offset)) >= 0) {
+        *val = sim_read(g, block, offset);
+        return 0;
+    }
+
+    return -EIO;
+}
+
+static int sim_store(struct garage_dev *g, dma_addr_t bus, u32 val)
+{
+    u32 *p, offset;
+    int block;
+
+    if((p = sim_bus_to_virt(g, bus, 4)) != NULL) {
+        *p = val;
+        return 0;
+    }
+
+    if((block = sim_periph(bus, &offset)) >= 0) {
+        sim_write(g, block, offset, val);
+        return 0;
+    }
+
+    return -EIO;
+}
+
+// execute a single CB
+static int sim_exec(struct garage_dev *g, const struct bcm2708_dma_cb *cb)
+{
+    int permap = (cb->info >> 16) & 0x1f;
+    int paced = (cb->info & BCM2708_DMA_D_DREQ) && permap == 5;
+    int x, y, xlen, ylen;
+    s32 sstride = 0, dstride = 0;
+    dma_addr_t src = cb->src, dst = cb->dst;
+    u32 val;
+
+    if(cb->info & BCM2708_DMA_TDMODE) {
+        xlen = cb->length & 0xffff;
+        ylen = ((cb->length >> 16) & 0x3fff) + 1;
+        sstride = (s16)(cb->stride & 0xffff);
+        dstride = (s16)(cb->stride >> 16);
+    } else {
+        xlen = cb->length;
+        ylen = 1;
+    }
+
+    if(xlen % 4) {
+        fprintf(stderr, "sim: CB length %d is not a multiple of 4\n", xlen);
+        return -EIO;
+    }
+
+    for(y=0;y<ylen;y++) {
+        for(x=0;x<xlen;x+=4) {
+            if(sim_load(g, src, &val) < 0) {
+                fprintf(stderr, "sim: CB reads unmapped address 0x%08x\n", src);
+                return -EIO;
+            }
+
+            if(paced && !sim_fifo_push(g))
+                return -EAGAIN;
+
+            if(sim_store(g, dst, val) < 0) {
+                fprintf(stderr, "sim: CB writes unmapped address 0x%08x\n", dst);
+                return -EIO;
+            }
+
+            if(cb->info & BCM2708_DMA_S_INC)
+                src += 4;
+            if(cb->info & BCM2708_DMA_D_INC)
+                dst += 4;
+        }
+
+        src += sstride;
+        dst += dstride;
+    }
+
+    return 0;
+}
+
+int sim_run(struct garage_dev *g)
+{
+    struct sim_state *s = sim(g);
+    u32 *dma = s->regs[GARAGE_DMA];
+    struct bcm2708_dma_cb cb, *p;
+    int err;
+
+    while(dma[BCM2708_DMA_CS/4] & BCM2708_DMA_ACTIVE) {
+        if(dma[BCM2708_DMA_ADDR/4] == 0) {
+            dma[BCM2708_DMA_CS/4] &= ~BCM2708_DMA_ACTIVE;
+            dma[BCM2708_DMA_CS/4] |= BIT(1);    // END
+            break;
+        }
+
+        p = sim_bus_to_virt(g, dma[BCM2708_DMA_ADDR/4], sizeof(cb));
+        if(p == NULL || dma[BCM2708_DMA_ADDR/4] % 32) {
+            fprintf(stderr, "sim: bad CB address 0x%08x\n", dma[BCM2708_DMA_ADDR/4]);
+            dma[BCM2708_DMA_CS/4] |= BCM2708_DMA_ERR;
+            return -EIO;
+        }
+
+        // the engine loads the whole CB before executing it
+        cb = *p;
+        dma[BCM2708_DMA_INFO/4] = cb.info;
+        dma[BCM2708_DMA_SOURCE_AD/4] = cb.src;
+        dma[BCM2708_DMA_DEST_AD/4] = cb.dst;
+        dma[BCM2708_DMA_NEXTCB/4] = cb.next;
+
+        s->dma_writing = 1;
+        err = sim_exec(g, &cb);
+        s->dma_writing = 0;
+
+        if(err < 0) {
+            if(err == -EIO)
+                dma[BCM2708_DMA_CS/4] |= BCM2708_DMA_ERR;
+            return err;
+        }
+
+        dma[BCM2708_DMA_ADDR/4] = cb.next;
+
+        if(cb.info & BCM2708_DMA_INT_EN) {
+            dma[BCM2708_DMA_CS/4] |= BCM2708_DMA_INT;
+            if(s->callback && (s->cyclic || !s->called)) {
+                s->called = 1;
+                s->callback(g);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void *sim_dma_alloc(struct garage_dev *g, size_t size, dma_addr_t *handle)
+{
+    struct sim_state *s = sim(g);
+    struct sim_region *r = NULL;
+    int i;
+
+    for(i=0;i<SIM_MAX_REGIONS;i++) {
+        if(s->regions[i].cpu == NULL) {
+            r = &s->regions[i];
+            break;
+        }
+    }
+
+    if(r == NULL)
+        return NULL;
+
+    r->cpu = calloc(1, size);
+    if(r->cpu == NULL)
+        return NULL;
+
+    // never reuse bus addresses, stale pointers into freed memory fault
+    r->bus = s->next_bus;
+    r->size = size;
+    s->next_bus += (size + 31) & ~31;
+
+    if(i >= s->nregions)
+        s->nregions = i + 1;
+
+    *handle = r->bus;
+
+    return r->cpu;
+}
+
+static void sim_dma_free(struct garage_dev *g, size_t size, void *cpu, dma_addr_t handle)
+{
+    struct sim_state *s = sim(g);
+    int i;
+
+    for(i=0;i<s->nregions;i++) {
+        if(s->regions[i].cpu == cpu) {
+            free(cpu);
+            s->regions[i].cpu = NULL;
+            return;
+        }
+    }
+}
+
+static struct bcm2708_dma_cb *sim_cb_alloc(struct garage_dev *g, dma_addr_t *handle)
+{
+    return sim_dma_alloc(g, CB_CHUNK_SIZE, handle);
+}
+
+static void sim_cb_free(struct garage_dev *g, struct bcm2708_dma_cb *cpu, dma_addr_t handle)
+{
+    sim_dma_free(g, CB_CHUNK_SIZE, cpu, handle);
+}
+
+static int sim_chan_claim(struct garage_dev *g, garage_callback_t callback, int cyclic)
+{
+    struct sim_state *s = sim(g);
+
+    s->callback = callback;
+    s->cyclic = cyclic;
+    s->called = 0;
+
+    return 0;
+}
+
+static u64 sim_now(struct garage_dev *g)
+{
+    return sim(g)->now_ps/1000;
+}
+
+static const struct garage_ops sim_ops = {
+    .read = sim_read,
+    .write = sim_write,
+    .dma_alloc = sim_dma_alloc,
+    .dma_free = sim_dma_free,
+    .cb_alloc = sim_cb_alloc,
+    .cb_free = sim_cb_free,
+    .chan_claim = sim_chan_claim,
+    .now = sim_now,
+};
+
+struct garage_dev *sim_create(void)
+{
+    struct garage_dev *g = calloc(1, sizeof(*g));
+    struct sim_state *s = calloc(1, sizeof(*s));
+
+    if(g == NULL || s == NULL) {
+        free(g);
+        free(s);
+        return NULL;
+    }
+
+    s->next_bus = SIM_BUS_BASE;
+    g->sim = s;
+    g->ops = &sim_ops;
+    stats_init(g);
+    health_init(g);
+
+    if(dma_allocate(g) < 0) {
+        sim_destroy(g);
+        return NULL;
+    }
+
+    return g;
+}
+
+void sim_destroy(struct garage_dev *g)
+{
+    struct sim_state *s = sim(g);
+    int i;
+
+    dma_release(g);
+
+    for(i=0;i<s->nregions;i++)
+        free(s->regions[i].cpu);
+
+    free(s->events);
+    free(s);
+    free(g);
+}
+
+int sim_events(struct garage_dev *g, const struct sim_event **ev)
+{
+    *ev = sim(g)->events;
+
+    return sim(g)->nevents;
+}
+
+void sim_clear_events(struct garage_dev *g)
+{
+    sim(g)->nevents = 0;
+}
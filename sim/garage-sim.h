@@ -0,0 +1,34 @@
+
+#ifndef __GARAGE_SIM_H__
+#define __GARAGE_SIM_H__
+
+#include "garage-driver.h"
+
+// a register write, by the CPU or by the DMA
+struct sim_event {
+    u64 t_ns;
+    int dma;                // written by a CB
+    int block;              // GARAGE_GPIO, ...
+    u32 offset;
+    u32 val;
+};
+
+struct garage_dev *sim_create(void);
+void sim_destroy(struct garage_dev *g);
+
+// walk the CB chain until the channel goes idle or stalls,
+// returns 0 when the chain has ended or was stopped, -EIO on DMA errors
+// and -EAGAIN when stalled on a DREQ which is never going to come
+int sim_run(struct garage_dev *g);
+
+// CPU view of a bus address handed out by dma_alloc, NULL if unknown
+void *sim_bus_to_virt(struct garage_dev *g, dma_addr_t bus, size_t len);
+
+// register writes recorded so far, sim_clear_events() starts over
+int sim_events(struct garage_dev *g, const struct sim_event **ev);
+void sim_clear_events(struct garage_dev *g);
+
+// frequency the PWM is clocked at, 0 when the clock is off
+u64 sim_pwm_clock(struct garage_dev *g);
+
+#endif
@@ -0,0 +1,264 @@
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "garage-driver.h"
+#include "garage-dma.h"
+#include "garage-gpio.h"
+#include "garage-pwm.h"
+#include "garage-clk.h"
+#include "garage-seq.h"
+#include "garage-enc.h"
+#include "garage-verify.h"
+#include "garage-sim.h"
+
+// Compile a sequence the way the driver does and run it on the simulator,
+// printing what goes on air.
+//
+//   garage-sim [-c carrier] [-r srate] [-e encoding] [-l levels] [-t tone,tone...]
+//              [-w from,to,step] [-n max_cbs] [-R repeat] [-k carrier2] [-f] [-v] [-V] [-s] [sequence]
+//
+// The sequence is read from stdin when not given, so binary sequences
+// can be piped in. -t switches to FSK with the given tone frequencies, -w
+// sweeps the carrier, -n sets the CB limit of a program, -f streams the
+// patterns through the PWM1 FIFO (ENGINE_FIFO), -R loops the frame 'repeat'
+// times (by default as many as the encoder asks for), -k keys a second carrier on GPCLK0 along with the first one.
+//
+// -V checks the compiled CBs against the sequence (see garage-verify.c)
+// and prints the decoded timeline instead of running it, -s prints the
+// stage latencies (in model time, so only the DMA side is meaningful) and
+// the health counters.
+
+#define MAX_SEQ 65536
+
+static int done;
+
+static void sim_done(void *data)
+{
+    struct garage_dev *g = data;
+
+    if(!garage_repeat_done(g))
+        return;
+
+    stats_record(g, STAGE_AIR, garage_now(g) - g->start_ns);
+    health_check(g, 0);
+    garage_stop(g);
+    done = 1;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: garage-sim [-c carrier] [-r srate] [-e encoding] [-l levels] [-t tone,tone...] [-w from,to,step] [-n max_cbs] [-R repeat] [-k carrier2] [-f] [-v] [-V] [-s] [sequence]\n");
+    exit(2);
+}
+
+static const char *block_name(int block)
+{
+    static const char *names[] = { "GPIO", "PWM", "CLK", "DMA" };
+
+    return block >= 0 && block < GARAGE_NBLOCKS ? names[block] : "?";
+}
+
+static void print_span(u64 at, int level, u64 len)
+{
+    char name[16];
+
+    if(SPAN_IS_TONE(level))
+        snprintf(name, sizeof(name), "f%d", level - SPAN_TONE(0));
+    else if(level == 0 || level == AMP_STEPS)
+        strcpy(name, level ? "on" : "off");
+    else
+        snprintf(name, sizeof(name), "%d/%d", level, AMP_STEPS);
+
+    printf("%12.3f us  %-5s %10.3f us\n", at/1000.0, name, len/1000.0);
+}
+
+// level of a DMA write to PWM1 data or FIFO (amplitude) or to the PWM
+// clock (tone)
+static int event_level(const struct sim_event *ev, const struct garage_params *tx, const u32 *tones, int ntones)
+{
+    int fifo = tx->engine == ENGINE_FIFO && tx->mod != MOD_FSK;
+    int i;
+
+    if(!ev->dma)
+        return -1;
+
+    // one bit per carrier cycle in the serializer pattern
+    if(ev->block == GARAGE_PWM && ev->offset == (fifo ? PWM_FIFO : PWM_DAT1))
+        return __builtin_popcount(ev->val);
+
+    if(ev->block == GARAGE_CLK && ev->offset == PWMCLK_DIV) {
+        for(i=0;i<ntones;i++) {
+            if(tones[i] == ev->val)
+                return SPAN_TONE(i);
+        }
+    }
+
+    return -1;
+}
+
+// print carrier amplitude (or tone) periods, or every register write with -v
+static void print_timeline(struct garage_dev *g, int verbose)
+{
+    const struct sim_event *ev;
+    int i, n = sim_events(g, &ev);
+    u64 start = 0, since = 0;
+    int level = -1, next, started = 0, ntones = 0;
+    u32 tones[TONES_MAX];
+
+    if(g->tx.mod == MOD_FSK)
+        ntones = pwm_tone_calc(&g->tx, tones);
+
+    for(i=0;i<n;i++) {
+        // sweep step, divider words are 12.12 fixed point
+        if(!verbose && g->tx.sweep_step && ev[i].dma && ev[i].block == GARAGE_CLK && ev[i].offset == PWMCLK_DIV) {
+            if(!started) {
+                start = since = ev[i].t_ns;
+                started = 1;
+            }
+            if(level >= 0 && ev[i].t_ns > since) {
+                print_span(since - start, level, ev[i].t_ns - since);
+                since = ev[i].t_ns;
+            }
+            printf("%12.3f us  carrier %.3f MHz\n", (ev[i].t_ns - start)/1000.0,
+                    GHZ/2e6*4096/(ev[i].val & 0xffffff));
+            continue;
+        }
+
+        if(verbose) {
+            printf("%12.3f us  %s %-4s 0x%02x <- 0x%08x\n",
+                    ev[i].t_ns/1000.0, ev[i].dma ? "dma" : "cpu",
+                    block_name(ev[i].block), ev[i].offset, ev[i].val);
+            continue;
+        }
+
+        if((next = event_level(&ev[i], &g->tx, tones, ntones)) < 0)
+            continue;
+
+        if(!started) {
+            start = since = ev[i].t_ns;
+            started = 1;
+        }
+
+        // the first writes come back to back, before anything is sent
+        if(level >= 0 && next != level && ev[i].t_ns > since) {
+            print_span(since - start, level, ev[i].t_ns - since);
+            since = ev[i].t_ns;
+        }
+
+        level = next;
+    }
+
+    if(!verbose && started && level >= 0)
+        print_span(since - start, level, garage_now(g) - since);
+}
+
+int main(int argc, char **argv)
+{
+    struct garage_params params = { 433920000, 2000, NULL, 2 };
+    char *tone;
+    int *sweep[] = { &params.sweep_from, &params.sweep_to, &params.sweep_step };
+    struct garage_dev *g;
+    static u8 seq[MAX_SEQ];
+    static char report[1 << 20];
+    size_t len;
+    int i, opt, err, verbose = 0, check = 0, stats = 0, max_cbs = 0, repeat = 0;
+
+    while((opt = getopt(argc, argv, "c:r:e:l:t:w:n:R:k:fvVs")) != -1) {
+        switch(opt) {
+            case 'c': params.freq = atoi(optarg); break;
+            case 'r': params.srate = atoi(optarg); break;
+            case 'e':
+                if((params.enc = encoder_find(optarg)) == NULL) {
+                    fprintf(stderr, "unknown encoding '%s'\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'l': params.levels = atoi(optarg); break;
+            case 't':
+                params.mod = MOD_FSK;
+                for(tone=strtok(optarg, ",");tone && params.ntones<TONES_MAX;tone=strtok(NULL, ","))
+                    params.tones[params.ntones++] = atoi(tone);
+                break;
+            case 'w':
+                for(i=0,tone=strtok(optarg, ",");tone && i<3;i++,tone=strtok(NULL, ","))
+                    *sweep[i] = atoi(tone);
+                break;
+            case 'n': max_cbs = atoi(optarg); break;
+            case 'R': repeat = atoi(optarg); break;
+            case 'k': params.carrier2 = atoi(optarg); break;
+            case 'f': params.engine = ENGINE_FIFO; break;
+            case 'v': verbose = 1; break;
+            case 'V': check = 1; break;
+            case 's': stats = 1; break;
+            default: usage();
+        }
+    }
+
+    // as the repeat attribute does
+    params.repeat = encoder_repeat(&params, repeat);
+
+    if(optind < argc) {
+        len = strlen(argv[optind]);
+        if(len > MAX_SEQ)
+            len = MAX_SEQ;
+        memcpy(seq, argv[optind], len);
+    } else {
+        len = fread(seq, 1, MAX_SEQ, stdin);
+    }
+
+    if((g = sim_create()) == NULL) {
+        fprintf(stderr, "failed to create simulator\n");
+        return 1;
+    }
+
+    if(max_cbs > 0)
+        g->max_cbs = max_cbs < CBS_LIMIT ? max_cbs : CBS_LIMIT;
+
+    if((err = garage_set_tx(g, &params)) < 0 ||
+            (err = garage_prepare(g, sim_done, params_repeating(&params))) < 0) {
+        fprintf(stderr, "failed to set up transmission: %s\n", strerror(-err));
+        return 1;
+    }
+
+    if((err = compile_sequence(g, &g->prog, &g->tx, seq, len)) < 0) {
+        fprintf(stderr, "failed to compile sequence: %s\n", strerror(-err));
+        return 1;
+    }
+
+    if(check) {
+        err = verify_sequence(g, &g->prog, &g->tx, seq, len, report, sizeof(report));
+        if(err < 0) {
+            fprintf(stderr, "failed to verify program: %s\n", strerror(-err));
+            return 1;
+        }
+
+        fputs(report, stdout);
+        sim_destroy(g);
+
+        return err;
+    }
+
+    garage_fire(g, &g->prog);
+    g->dreq_probe = stats;
+    garage_probe_dreq(g, &g->prog);
+
+    if((err = sim_run(g)) < 0 || !done) {
+        fprintf(stderr, "DMA did not complete: %s\n", err < 0 ? strerror(-err) : "no interrupt");
+        return 1;
+    }
+
+    print_timeline(g, verbose);
+    printf("%d CBs, %.3f ms on air\n", g->prog.sample, (garage_now(g) - g->start_ns)/1e6);
+
+    if(stats) {
+        stats_print(g, report, sizeof(report));
+        fputs(report, stdout);
+        health_print(g, report, sizeof(report));
+        fputs(report, stdout);
+    }
+
+    sim_destroy(g);
+
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include <stdlib.h>
+
+#include "garage-driver.h"
+#include "garage-dma.h"
+#include "garage-pwm.h"
+#include "garage-clk.h"
+#include "garage-seq.h"
+#include "garage-enc.h"
+#include "garage-sim.h"
+
+// Runs sequences on the simulator and checks what goes on air, see
+// `make test`. The carrier is turned into one character per sample, '1'
+// for on and '0' for off, from the times of the DMA writes (the lead-in
+// writes come back to back, so they do not show).
+
+#define MAX_SAMPLES 4096
+#define MAX_STEPS   64
+
+// what went on air
+struct air {
+    char bits[MAX_SAMPLES + 1];
+    int samples;
+    int steps;                  // carrier divider writes by the DMA (sweep steps)
+    int step_at[MAX_STEPS];     // sample of each
+    u32 step_div[MAX_STEPS];
+};
+
+static int failed, done;
+
+#define CHECK(cond) do { \
+    if(!(cond)) { \
+        fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+        failed++; \
+    } \
+} while(0)
+
+static void test_done(void *data)
+{
+    struct garage_dev *g = data;
+
+    if(!garage_repeat_done(g))
+        return;
+
+    garage_stop(g);
+    done = 1;
+}
+
+// append level for the time from 'since' to 'now'
+static void air_fill(struct air *a, int level, u64 since, u64 now, u64 period_ns)
+{
+    int n = (now - since + period_ns/2) / period_ns;
+
+    while(n-- > 0 && a->samples < MAX_SAMPLES)
+        a->bits[a->samples++] = level ? '1' : '0';
+}
+
+static int air_run(struct garage_params *params, const char *seq, struct air *a)
+{
+    struct garage_dev *g;
+    const struct sim_event *ev;
+    u64 since = 0, period_ns = 1000000000ULL / params->srate;
+    int i, n, err, level = -1, next;
+    u32 data = params->engine == ENGINE_FIFO ? PWM_FIFO : PWM_DAT1;
+
+    memset(a, 0, sizeof(*a));
+    done = 0;
+
+    if((g = sim_create()) == NULL)
+        return -ENOMEM;
+
+    if((err = garage_set_tx(g, params)) < 0 ||
+            (err = garage_prepare(g, test_done, params_repeating(params))) < 0 ||
+            (err = compile_sequence(g, &g->prog, &g->tx, (const u8 *)seq, strlen(seq))) < 0)
+        goto out;
+
+    garage_fire(g, &g->prog);
+
+    if((err = sim_run(g)) < 0)
+        goto out;
+    if(!done) {
+        err = -ETIME;
+        goto out;
+    }
+
+    n = sim_events(g, &ev);
+    for(i=0;i<n;i++) {
+        if(!ev[i].dma)
+            continue;
+
+        if(ev[i].block == GARAGE_CLK && ev[i].offset == PWMCLK_DIV && a->steps < MAX_STEPS) {
+            if(level >= 0) {
+                air_fill(a, level, since, ev[i].t_ns, period_ns);
+                since = ev[i].t_ns;
+            }
+            a->step_at[a->steps] = a->samples;
+            a->step_div[a->steps++] = ev[i].val & 0xffffff;
+            continue;
+        }
+
+        if(ev[i].block != GARAGE_PWM || ev[i].offset != data)
+            continue;
+
+        next = ev[i].val != 0;
+        if(level < 0)
+            since = ev[i].t_ns;
+        if(level >= 0 && next != level) {
+            air_fill(a, level, since, ev[i].t_ns, period_ns);
+            since = ev[i].t_ns;
+        }
+        level = next;
+    }
+
+    if(level >= 0)
+        air_fill(a, level, since, garage_now(g), period_ns);
+
+out:
+    sim_destroy(g);
+    return err;
+}
+
+static void params_init(struct garage_params *params, const char *enc, int repeat)
+{
+    memset(params, 0, sizeof(*params));
+    params->freq = 433920000;
+    params->srate = 2000;
+    params->levels = 2;
+    if(enc)
+        params->enc = encoder_find(enc);
+    params->repeat = encoder_repeat(params, repeat);
+}
+
+// "10" + inverted bit for each of 0, code, 0 in the frame, a "1111"
+// preamble and "0" postamble, see garage-proto.c
+#define TRIPLET_01  "101" "101" "100" "101" "11111"
+
+static void test_plain(void)
+{
+    struct garage_params params;
+    struct air a;
+
+    params_init(&params, NULL, 0);
+    CHECK(air_run(&params, "0110", &a) == 0);
+    CHECK(strcmp(a.bits, "0110") == 0);
+}
+
+static void test_triplet_edges(void)
+{
+    struct garage_params params;
+    struct air a;
+
+    params_init(&params, "triplet", 1);
+    CHECK(params.enc != NULL);
+    CHECK(air_run(&params, "01", &a) == 0);
+    CHECK(strcmp(a.bits, "1111" TRIPLET_01 "0") == 0);
+}
+
+static void test_repeat(void)
+{
+    struct garage_params params;
+    struct air a;
+
+    params_init(&params, "triplet", 3);
+    CHECK(params.repeat == 3);
+    CHECK(air_run(&params, "01", &a) == 0);
+    CHECK(strcmp(a.bits, "1111" TRIPLET_01 TRIPLET_01 TRIPLET_01 "0") == 0);
+}
+
+static void test_fifo(void)
+{
+    struct garage_params params;
+    struct air a;
+
+    params_init(&params, NULL, 0);
+    params.engine = ENGINE_FIFO;
+    CHECK(air_run(&params, "0110100", &a) == 0);
+    CHECK(strcmp(a.bits, "0110100") == 0);
+}
+
+static void test_sweep(void)
+{
+    struct garage_params params;
+    struct air a;
+    int i;
+
+    params_init(&params, NULL, 0);
+    params.freq = 40685000;
+    params.sweep_from = 40600000;
+    params.sweep_to = 40800000;
+    params.sweep_step = 25000;
+    params.repeat = encoder_repeat(&params, 0);
+    CHECK(air_run(&params, "0110", &a) == 0);
+
+    // 40.600 to 40.800 MHz, the frame once at each step after two
+    // samples of carrier off
+    CHECK(a.steps == 9);
+    CHECK(a.samples == 9*6);
+    for(i=0;i<a.steps;i++) {
+        CHECK(a.step_at[i] == i*6);
+        CHECK(strncmp(a.bits + i*6, "000110", 6) == 0);
+        // a higher carrier is a smaller divider
+        if(i > 0)
+            CHECK(a.step_div[i] < a.step_div[i-1]);
+    }
+
+    // 1.7% below the carrier, the frame would stretch as much
+    params.sweep_from = 40000000;
+    CHECK(air_run(&params, "0110", &a) == -EINVAL);
+}
+
+int main(void)
+{
+    test_plain();
+    test_triplet_edges();
+    test_repeat();
+    test_fifo();
+    test_sweep();
+
+    if(failed) {
+        fprintf(stderr, "%d checks failed\n", failed);
+        return 1;
+    }
+
+    printf("all tests passed\n");
+
+    return 0;
+}
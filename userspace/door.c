@@ -1,28 +1,115 @@
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
+#include <sched.h>
+#include <time.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 
+#include "garage-proto.h"
+
 #define PAGE_SIZE (4*1024)
 
 #define BCM2708_PERI_BASE	0x3F000000
+#define BUS_PERI_BASE           0x7E000000
 #define CLK_BASE                (BCM2708_PERI_BASE + 0x00101000)
 #define CLK_LEN                 0xA8
 #define GPIO_BASE               (BCM2708_PERI_BASE + 0x00200000)
 #define GPIO_LEN                0xB4
+#define PWM_BASE                (BCM2708_PERI_BASE + 0x0020C000)
+#define PWM_LEN                 0x28
+#define DMA_BASE                (BCM2708_PERI_BASE + 0x00007000)
+#define DMA_LEN                 0x24
+
+#define BUS_ADDR(x)             ((x) - BCM2708_PERI_BASE + BUS_PERI_BASE)
 
 #define GPCLK_CNTL              (0x70/4)
 #define GPCLK_DIV               (0x74/4)
+#define PWMCLK_CNTL             (0xA0/4)
+#define PWMCLK_DIV              (0xA4/4)
+
+#define GPIO_FSEL0              (0x00/4)
+
+#define PWM_CTRL                (0x00/4)
+#define PWM_DMAC                (0x08/4)
+#define PWM_RNG1                (0x10/4)
+#define PWM_FIFO                (0x18/4)
+
+#define PWMCTRL_PWEN1           (1 << 0)
+#define PWMCTRL_CLRF            (1 << 6)
+#define PWMCTRL_USEF1           (1 << 5)
+#define PWMCTRL_MSEN1           (1 << 7)
+#define PWMDMAC_ENAB            (1 << 31)
+
+#define DMA_CS                  (0x00/4)
+#define DMA_CONBLK_AD           (0x04/4)
+
+#define DMA_ACTIVE              (1 << 0)
+#define DMA_END                 (1 << 1)
+#define DMA_ABORT               (1 << 30)
+#define DMA_RESET               (1 << 31)
+
+#define DMA_WAIT_RESP           (1 << 3)
+#define DMA_D_DREQ              (1 << 6)
+#define DMA_PER_MAP(x)          ((x) << 16)
+#define DMA_NO_WIDE_BURSTS      (1 << 26)
+
+// pick a channel nobody else uses, see /sys/kernel/debug/dma (lite
+// channels 7-14 are fine, runs are split to fit their 16 bit lengths)
+#define DMA_CHAN                14
+#define RUN_MAX_WORDS           0x3fff
 
 #define ANTENNA_PIN		4
 
+#define PLL_192MHZ		0x1
 #define PLL_1GHZ		0x5
 
+// symbol period, in PWM clocks of 10us (19.2MHz oscillator / 192)
+#define BIT_US                  700
+#define PWM_CLK_US              10
+
+// VideoCore mailbox, for memory the DMA can see
+#define MBOX_DEV                "/dev/vcio"
+#define IOCTL_MBOX_PROPERTY     _IOWR(100, 0, char *)
+#define MBOX_MEM_ALLOC          0x3000c
+#define MBOX_MEM_LOCK           0x3000d
+#define MBOX_MEM_UNLOCK         0x3000e
+#define MBOX_MEM_RELEASE        0x3000f
+#define MEM_FLAG_DIRECT         0x4     // 0xC0000000 bus alias, uncached
+
+#define MAX_BITS                4096
+
+// CPU timing: first edge this far in the future, lateness histogram has
+// log2 buckets of nanoseconds
+#define START_DELAY_NS          1000000
+#define LATE_BUCKETS            32
+
+struct dma_cb {
+    uint32_t info, src, dst, length, stride, next, pad[2];
+};
+
 volatile uint32_t *gpio_reg;
+volatile uint32_t *clk_reg;
+volatile uint32_t *pwm_reg;
+volatile uint32_t *dma_reg;
+
+// the frame, one entry per symbol period
+static unsigned char bits[MAX_BITS];
+static int nbits;
+
+// uncached memory holding the CBs
+static struct {
+    int fd;
+    unsigned handle, bus, size;
+    void *virt;
+} mem = { -1 };
 
 
 void *
@@ -31,13 +118,13 @@ mapmem(unsigned base, unsigned size)
     int mem_fd;
     unsigned offset = base % PAGE_SIZE;
     base = base - offset;
-    
+
     if ((mem_fd = open("/dev/mem", O_RDWR|O_SYNC) ) < 0) {
         perror("open: /dev/mem");
 	exit(-1);
     }
 
-    void *mem = mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, mem_fd, base);
+    void *mem = mmap(0, size + offset, PROT_READ|PROT_WRITE, MAP_SHARED, mem_fd, base);
 
     if (mem == MAP_FAILED) {
 	perror("mmap");
@@ -70,7 +157,8 @@ init_clk()
     double freq = 40.685e6;
     unsigned char mash = 3;
     int divi, divf;
-    volatile uint32_t *clk_reg = mapmem(CLK_BASE, CLK_LEN);
+
+    clk_reg = mapmem(CLK_BASE, CLK_LEN);
 
     divi = 1e9/freq;
     divf = (1e9/freq - divi)*0x1000;
@@ -85,57 +173,350 @@ init_clk()
     usleep(300);
 }
 
+// append a run of symbols to the frame
+int
+outrun(void *ctx, int on, unsigned int len)
+{
+    if(len > MAX_BITS - nbits)
+        return -1;
+
+    memset(bits + nbits, on, len);
+    nbits += len;
+
+    return 0;
+}
+
+uint64_t
+now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
 void
-outbit(int b)
+sleep_until(uint64_t t)
 {
-    gpio_setmode(ANTENNA_PIN, b ? 4 : 0); // Clock out or GPO?
-    usleep(700);
+    struct timespec ts = { t/1000000000ULL, t%1000000000ULL };
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+        ;
 }
 
+// lateness of the carrier edges
+static struct {
+    int n;
+    uint64_t min, max, sum;
+    int buckets[LATE_BUCKETS];
+} late;
+
 void
-outtriplet(int b)
+late_record(uint64_t ns)
 {
-    outbit(1);
-    outbit(0);
-    outbit(!b);
+    int b = 0;
+
+    while(b < LATE_BUCKETS-1 && ns >> b > 1)
+        b++;
+
+    if(late.n == 0 || ns < late.min)
+        late.min = ns;
+    if(ns > late.max)
+        late.max = ns;
+    late.sum += ns;
+    late.buckets[b]++;
+    late.n++;
 }
 
-int
-main(int argc, const char **argv)
+void
+late_print()
 {
     int i;
-    const char *code, *p;
 
-    if(argc != 2) {
-        fprintf(stderr, "Usage: %s <door combination>\n", argv[0]);
+    if(late.n == 0)
+        return;
+
+    fprintf(stderr, "%d edges late by min %llu, avg %llu, max %llu ns\n", late.n,
+            (unsigned long long)late.min, (unsigned long long)(late.sum/late.n),
+            (unsigned long long)late.max);
+
+    for(i=0;i<LATE_BUCKETS;i++) {
+        if(late.buckets[i])
+            fprintf(stderr, "  < %10llu ns %6d\n", 2ULL << i, late.buckets[i]);
+    }
+}
+
+// CPU timed: every carrier edge is fired at an absolute deadline from the
+// start of the frame, so wake-up delays and the cost of gpio_setmode() do
+// not add up. With 'spin' the last microseconds before each edge are
+// busy waited.
+void
+send_cpu(int spin_us)
+{
+    uint64_t start, t, deadline;
+    int i, j;
+
+    start = now_ns() + START_DELAY_NS;
+
+    for(i=0;i<nbits;i=j) {
+        for(j=i;j<nbits && bits[j] == bits[i];j++)
+            ;
+
+        deadline = start + (uint64_t)i*BIT_US*1000;
+
+        if(spin_us) {
+            sleep_until(deadline - spin_us*1000);
+            while(now_ns() < deadline)
+                ;
+        } else {
+            sleep_until(deadline);
+        }
+
+        gpio_setmode(ANTENNA_PIN, bits[i] ? 4 : 0); // Clock out or GPO?
+        t = now_ns();
+        late_record(t > deadline ? t - deadline : 0);
+    }
+
+    sleep_until(start + (uint64_t)nbits*BIT_US*1000);
+}
+
+// run at SCHED_FIFO 'prio' (0 to leave it), on CPU 'cpu' (-1 for any)
+void
+set_realtime(int prio, int cpu)
+{
+    struct sched_param sp = { .sched_priority = prio };
+    cpu_set_t set;
+
+    if(cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if(sched_setaffinity(0, sizeof(set), &set) < 0)
+            perror("sched_setaffinity");
+    }
+
+    if(prio > 0) {
+        if(sched_setscheduler(0, SCHED_FIFO, &sp) < 0)
+            perror("sched_setscheduler");
+        if(mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+            perror("mlockall");
+    }
+}
+
+unsigned
+mbox_property(int fd, unsigned tag, unsigned a, unsigned b, unsigned c)
+{
+    uint32_t msg[9] = { sizeof(msg), 0, tag, 12, 12, a, b, c, 0 };
+
+    if(ioctl(fd, IOCTL_MBOX_PROPERTY, msg) < 0) {
+        perror("ioctl: " MBOX_DEV);
+        exit(-1);
+    }
+
+    return msg[5];
+}
+
+void
+mem_free()
+{
+    if(mem.virt) {
+        munmap(mem.virt, mem.size);
+        mbox_property(mem.fd, MBOX_MEM_UNLOCK, mem.handle, 0, 0);
+        mbox_property(mem.fd, MBOX_MEM_RELEASE, mem.handle, 0, 0);
+        mem.virt = NULL;
+    }
+}
+
+void
+mem_alloc(unsigned size)
+{
+    if ((mem.fd = open(MBOX_DEV, 0)) < 0) {
+        perror("open: " MBOX_DEV);
 	exit(-1);
     }
 
-    code = argv[1];
+    mem.size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    mem.handle = mbox_property(mem.fd, MBOX_MEM_ALLOC, mem.size, PAGE_SIZE, MEM_FLAG_DIRECT);
+    if(mem.handle == 0) {
+        fprintf(stderr, "Failed to allocate %u bytes of GPU memory\n", mem.size);
+        exit(-1);
+    }
 
-    init_gpio();
-    init_clk();
+    mem.bus = mbox_property(mem.fd, MBOX_MEM_LOCK, mem.handle, 0, 0);
+    mem.virt = mapmem(mem.bus & ~0xC0000000, mem.size);
+}
 
-    outbit(1);
-    outbit(1);
-    outbit(1);
-    outbit(1);
+void
+dma_stop()
+{
+    dma_reg[DMA_CS] = DMA_RESET | DMA_ABORT;
+    pwm_reg[PWM_CTRL] = PWMCTRL_CLRF;
+    pwm_reg[PWM_DMAC] = 0;
+    clk_reg[PWMCLK_CNTL] = 0x5A000000 | PLL_192MHZ;
+    gpio_setmode(ANTENNA_PIN, 0);
+    mem_free();
+}
 
-    outtriplet(0);
+void
+dma_abort(int sig)
+{
+    dma_stop();
+    exit(1);
+}
+
+// PWM1 pops one FIFO word per symbol period, the DMA engine feeds it
+// under DREQ so the GPIO function select writes between the FIFO words
+// are timed by the PWM clock
+void
+init_pwm()
+{
+    pwm_reg = mapmem(PWM_BASE, PWM_LEN);
+
+    pwm_reg[PWM_CTRL] = PWMCTRL_CLRF;
+    clk_reg[PWMCLK_CNTL] = 0x5A000000 | PLL_192MHZ;
+    usleep(100);
+    clk_reg[PWMCLK_DIV] = 0x5A000000 | (192 << 12);
+    clk_reg[PWMCLK_CNTL] = 0x5A000010 | PLL_192MHZ;
+    usleep(100);
+
+    pwm_reg[PWM_RNG1] = BIT_US/PWM_CLK_US;
+    pwm_reg[PWM_DMAC] = PWMDMAC_ENAB | 1; // 1 word threshold, no read ahead
+    pwm_reg[PWM_CTRL] = PWMCTRL_CLRF | PWMCTRL_PWEN1 | PWMCTRL_MSEN1 | PWMCTRL_USEF1;
+}
 
-    for(i=0;i<5;i++) {
-        outtriplet(0);
-        for(p=code;*p;p++) {
-            outtriplet(*p == '1');
+struct dma_cb *
+add_cb(struct dma_cb *cbs, int *n, uint32_t info, uint32_t src, uint32_t dst, uint32_t len)
+{
+    struct dma_cb *cb = &cbs[*n];
+
+    cb->info = info | DMA_WAIT_RESP | DMA_NO_WIDE_BURSTS;
+    cb->src = src;
+    cb->dst = dst;
+    cb->length = len;
+    cb->stride = 0;
+    cb->next = 0;
+
+    if(*n > 0)
+        cbs[*n-1].next = mem.bus + 32 + *n*sizeof(*cb);
+    (*n)++;
+
+    return cb;
+}
+
+// DMA timed: one GPFSEL0 write per run of equal symbols and a DREQ paced
+// FIFO transfer as long as the run, the CPU sleeps until it is all done
+void
+send_dma()
+{
+    volatile uint32_t *words;
+    struct dma_cb *cbs;
+    uint32_t fsel;
+    int i, j, n = 0, len;
+
+    dma_reg = mapmem(DMA_BASE + 0x100*DMA_CHAN, DMA_LEN);
+    init_pwm();
+
+    // constant words, then the CBs (32 byte aligned), at most 2 per symbol
+    mem_alloc(32 + (2*nbits + 1)*sizeof(struct dma_cb));
+    signal(SIGINT, dma_abort);
+    signal(SIGTERM, dma_abort);
+
+    words = mem.virt;
+    cbs = (struct dma_cb *)((char *)mem.virt + 32);
+
+    // the whole GPFSEL0 is written, keep the other pins as they are now
+    fsel = gpio_reg[GPIO_FSEL0] & ~(7 << 3*ANTENNA_PIN);
+    words[0] = fsel;
+    words[1] = fsel | 4 << 3*ANTENNA_PIN; // GPCLK0
+    words[2] = 0; // FIFO filler
+
+    for(i=0;i<nbits;i=j) {
+        for(j=i;j<nbits && bits[j] == bits[i];j++)
+            ;
+
+        add_cb(cbs, &n, 0, mem.bus + 4*bits[i], BUS_ADDR(GPIO_BASE) + 4*GPIO_FSEL0, 4);
+
+        for(len=j-i;len>0;len-=RUN_MAX_WORDS) {
+            add_cb(cbs, &n, DMA_D_DREQ | DMA_PER_MAP(5),
+                    mem.bus + 8, BUS_ADDR(PWM_BASE) + 4*PWM_FIFO,
+                    4*(len < RUN_MAX_WORDS ? len : RUN_MAX_WORDS));
+        }
+    }
+
+    // carrier off at the end, whatever the frame ends with
+    add_cb(cbs, &n, 0, mem.bus, BUS_ADDR(GPIO_BASE) + 4*GPIO_FSEL0, 4);
+
+    __sync_synchronize();
+
+    dma_reg[DMA_CS] = DMA_RESET;
+    usleep(10);
+    dma_reg[DMA_CS] = DMA_END;
+    dma_reg[DMA_CONBLK_AD] = mem.bus + 32;
+    dma_reg[DMA_CS] = DMA_ACTIVE;
+
+    usleep(nbits*BIT_US);
+    while(dma_reg[DMA_CS] & DMA_ACTIVE)
+        usleep(1000);
+
+    dma_stop();
+}
+
+void
+usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-e encoding] [-u] [-p prio] [-c cpu] [-s us] <door combination>\n", name);
+    fprintf(stderr, "  -e enc   remote protocol, triplet (default), manchester or tristate\n");
+    fprintf(stderr, "  -u       time the symbols from the CPU instead of DMA\n");
+    fprintf(stderr, "  -p prio  run at SCHED_FIFO priority 'prio' (-u)\n");
+    fprintf(stderr, "  -c cpu   pin to CPU 'cpu' (-u)\n");
+    fprintf(stderr, "  -s us    busy wait the last 'us' microseconds before each edge (-u)\n");
+    exit(-1);
+}
+
+int
+main(int argc, char **argv)
+{
+    const struct garage_encoder *enc = proto_find("triplet");
+    int err, opt, cpu = 0, prio = 0, pin = -1, spin = 0;
+    const char *code;
+
+    while((opt = getopt(argc, argv, "e:up:c:s:")) != -1) {
+        switch(opt) {
+            case 'e':
+                if((enc = proto_find(optarg)) == NULL) {
+                    fprintf(stderr, "Unknown encoding '%s'\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'u': cpu = 1; break;
+            case 'p': prio = atoi(optarg); break;
+            case 'c': pin = atoi(optarg); break;
+            case 's': spin = atoi(optarg); break;
+            default: usage(argv[0]);
         }
-        outtriplet(0);
-        outbit(1);
-        outbit(1);
-        outbit(1);
-        outbit(1);
-        outbit(1);
     }
-    outbit(0);
+
+    if(optind != argc - 1)
+        usage(argv[0]);
+
+    code = argv[optind];
+
+    // the same framing the kernel module's line encoders use
+    if((err = proto_expand(enc, (const unsigned char *)code, strlen(code), outrun, NULL)) < 0) {
+        fprintf(stderr, err == PROTO_EINVAL ? "Invalid door combination\n" : "Door combination too long\n");
+        exit(-1);
+    }
+
+    init_gpio();
+    init_clk();
+
+    if(cpu) {
+        set_realtime(prio, pin);
+        send_cpu(spin);
+        late_print();
+    } else {
+        send_dma();
+    }
 
     gpio_setmode(ANTENNA_PIN, 0);
 